@@ -0,0 +1,32 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+#include "ijvm.h"
+
+// Ahead-of-time translation of a whole program to C. Every method becomes a
+// C function with one label per instruction and gotos for branches. The C
+// file is compiled into a shared object with $IJVM_CC (clang by default)
+// and dlopen'd. The object is cached next to the binary as
+// <binary>.<hash>.so, where hash covers the constant pool and text, so
+// later runs of the same program load it directly.
+//
+// Native code exits with pc and the stack written back wherever it meets
+// IN, OUT, INVOKEVIRTUAL, IRETURN, HALT, ERR or anything it cannot
+// translate, and run_aot() executes that instruction with step().
+
+// Loads (building it first if needed) the native image of m, which was
+// loaded from binary_path, or from memory when binary_path is NULL; the
+// object then goes to $TMPDIR/ijvm.<hash>.so. Returns false and leaves m
+// interpreted when the object cannot be built or loaded, and straight away
+// when m runs checked (see verify.h), which run() never leaves for native
+// code.
+bool aot_enable(ijvm *m, const char *binary_path);
+
+// Unloads the native image of m. Safe to call when AOT is disabled.
+void aot_destroy(ijvm *m);
+
+// Runs the machine until it halts, alternating native code and step().
+void run_aot(ijvm *m);
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdbool.h>
+#include "ijvm.h"
+#include "insn_struct.h"
+
+// Opcodes of the pre-decoded instruction stream, as an X-macro of
+// X(name, base) entries. WIDE is folded into the instruction it prefixes,
+// unknown opcodes become D_SKIP and the slots past the end of the text
+// section hold D_END.
+//
+// After D_END come the superinstructions, only ever found in insn.xop, whose
+// operands are read from the entries of the instructions they cover, and
+// the quick forms written into insn.xop by quicken_text() when the program
+// is loaded. Quick forms keep op and a, so every other consumer of the
+// stream still sees the original instruction.
+//
+// base is the op that runs in place of name when superinstructions are not
+// wanted: the first instruction a superinstruction covers, else name itself.
+#define DECODED_OPS(X) \
+  X(NOP, NOP) \
+  X(BIPUSH, BIPUSH) \
+  X(DUP, DUP) \
+  X(ERR, ERR) \
+  X(GOTO, GOTO) \
+  X(HALT, HALT) \
+  X(IADD, IADD) \
+  X(IAND, IAND) \
+  X(IFEQ, IFEQ) \
+  X(IFLT, IFLT) \
+  X(IF_ICMPEQ, IF_ICMPEQ) \
+  X(IINC, IINC) \
+  X(ILOAD, ILOAD) \
+  X(IN, IN) \
+  X(INVOKEVIRTUAL, INVOKEVIRTUAL) \
+  X(IOR, IOR) \
+  X(IRETURN, IRETURN) \
+  X(ISTORE, ISTORE) \
+  X(ISUB, ISUB) \
+  X(LDC_W, LDC_W) \
+  X(OUT, OUT) \
+  X(POP, POP) \
+  X(SWAP, SWAP) \
+  X(NEWARRAY, NEWARRAY) \
+  X(IALOAD, IALOAD) \
+  X(IASTORE, IASTORE) \
+  X(GC, GC) \
+  X(SKIP, SKIP) \
+  X(END, END) \
+  X(ILOAD_ILOAD_IADD, ILOAD) \
+  X(ILOAD_ILOAD_ISUB, ILOAD) \
+  X(BIPUSH_IADD, BIPUSH) \
+  X(BIPUSH_ISUB, BIPUSH) \
+  X(BIPUSH_IF_ICMPEQ, BIPUSH) \
+  X(DUP_IFEQ, DUP) \
+  X(ILOAD_IFEQ, ILOAD) \
+  X(ILOAD_IFLT, ILOAD) \
+  X(ISUB_IFLT, ISUB) \
+  X(IAND_IFEQ, IAND) \
+  X(IINC_GOTO, IINC) \
+  X(LDC_W_QUICK, LDC_W_QUICK) \
+  X(INVOKEVIRTUAL_QUICK, INVOKEVIRTUAL_QUICK)
+
+#define DECODED_OP_ENUM(name, base) D_##name,
+
+typedef enum DECODED_OP {
+  DECODED_OPS(DECODED_OP_ENUM)
+  D_COUNT
+} decoded_op;
+
+// Longest encoded instruction (WIDE IINC). The decoded stream is padded with
+// this many D_END entries so that falling through a truncated instruction at
+// the end of the text section still lands on a sentinel.
+#define CODE_PADDING 5
+
+// Translates the text section into p->code, one entry per byte offset plus
+// the D_END padding. Operands are widened and sign-extended, and branch
+// targets are resolved to absolute offsets.
+bool decode_text(ijvm_program *p);
+
+// Replaces the xop of every entry that starts a known instruction sequence
+// with the matching superinstruction. Called by decode_text().
+void fuse_text(ijvm_program *p);
+
+// Resolves the constant pool lookups of every LDC_W and INVOKEVIRTUAL entry
+// and switches its xop to the quick form. LDC_W_QUICK keeps the constant in
+// b. INVOKEVIRTUAL_QUICK keeps the pc of the first instruction of the method
+// in b and its index in the method table in c. Entries whose constant index
+// is out of range or does not name a method of the table are left alone.
+// Needs the method table, so it runs after build_method_table().
+void quicken_text(ijvm_program *p);
+
+// Fills p->run_cost: for every pc, the number of instructions from it up to
+// and including the next one that can transfer control (a branch, call,
+// return, HALT or ERR) or the last one before the end of the text. A
+// machine that starts running at pc runs exactly those unless it stops
+// early. The D_END padding costs nothing.
+bool measure_runs(ijvm_program *p);
+
+// Whether the instruction only touches the operand stack, the locals of the
+// current frame and the pc, so a native tier can run it inline. I/O, calls,
+// array instructions, HALT/ERR, unknown opcodes and LDC_W with a bad index
+// are not.
+bool insn_is_self_contained(ijvm_program *p, const insn *in);
+
+// Operands the instruction takes off the stack and puts back. The
+// arguments an INVOKEVIRTUAL pops depend on its callee and are not counted.
+void insn_stack_effect(const insn *in, int32_t *pops, int32_t *pushes);
+
+// Whether a decoded op transfers control to the absolute target in insn.a
+bool insn_is_branch(const insn *in);
+
+// Whether execution may continue at pc + len after the instruction
+bool insn_falls_through(const insn *in);
+
+// Collects into out the pcs reachable from entry by following branches and
+// fallthroughs (not calls), skipping pcs already marked in seen and marking
+// the ones found. worklist needs room for 2 * text_size + 1 entries. Returns
+// the number of pcs collected, sorted ascending.
+uint32_t collect_reachable(ijvm_program *p, word_t entry, bool *seen, word_t *out, word_t *worklist);
+
+// Decodes the single instruction starting at byte offset pc.
+void decode_insn(ijvm_program *p, uint32_t pc, insn *out);
+
+#endif
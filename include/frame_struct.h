@@ -0,0 +1,22 @@
+#ifndef FRAME_STRUCT_H
+#define FRAME_STRUCT_H
+
+#include "ijvm_types.h"
+
+// Record of one method invocation. Frames live on their own stack, so the
+// operand stack only holds arguments, locals and operands.
+typedef struct FRAME {
+  word_t return_pc; // pc of the instruction after the INVOKEVIRTUAL
+  word_t lv;        // lv of the caller
+  uint32_t height;  // operand stack height to return to, below the arguments
+  word_t method;    // offset of the callee's method header in the text
+} frame;
+
+typedef struct CALL_STACK {
+  frame *data;
+  uint32_t size;
+  uint32_t depth;
+
+} call_stack;
+
+#endif 
@@ -0,0 +1,72 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "ijvm.h"
+
+// Arrays made by NEWARRAY. Each one is a length word followed by its
+// elements, zeroed, inside a chunk of the machine's heap. Small arrays are
+// taken from the free lists, or else bumped out of chunks that double in
+// size up to HEAP_CHUNK_WORDS; larger ones get a chunk of their own.
+// heap_destroy() releases all chunks at once.
+//
+// A reference is the index of the chunk in its upper bits and the offset of
+// the length word in its lower HEAP_OFFSET_BITS. Unused entries of the chunk
+// table, and chunk 0, hold a single word reading as length 0, so references
+// that were never handed out, 0 included, have no elements. Since offsets
+// are masked with the size of the chunk, even a forged reference cannot
+// reach outside the heap, and an access needs only the check of the index
+// against the length.
+//
+// heap_collect() is a mark-sweep collector. Its roots, and the elements of
+// reachable arrays, are taken to be references whenever they name a live
+// array; marks go into a bitmap beside each chunk. The sweep
+// merges neighbouring dead blocks, gives back chunks left without a live
+// array and links the remaining free blocks into per size class free lists.
+// Collected arrays read as length 0 until their words are reused.
+
+#define HEAP_OFFSET_BITS 16
+#define HEAP_OFFSET_MASK ((1u << HEAP_OFFSET_BITS) - 1)
+
+// Sizes of the chunks small arrays come from, in words
+#define HEAP_FIRST_CHUNK 1024
+#define HEAP_CHUNK_WORDS (1u << HEAP_OFFSET_BITS)
+
+// Arrays of more words than this, length word included, get their own chunk
+#define HEAP_SMALL_WORDS (HEAP_CHUNK_WORDS / 4)
+
+// Longest array NEWARRAY makes
+#define HEAP_MAX_LENGTH ((1 << 28) - 1)
+
+// Words a machine allocates before its first automatic collection. Later
+// ones wait until as much has been allocated as the last one left alive.
+#define HEAP_GC_WORDS ((size_t)1 << 20)
+
+// Whether the next NEWARRAY should collect first
+#define HEAP_COLLECTION_DUE(h) ((h)->allocated >= (h)->threshold)
+
+void heap_init(heap *h);
+
+// Frees every chunk, leaving h empty.
+void heap_destroy(heap *h);
+
+// Allocates an array of count elements and returns its reference, or 0 when
+// count is negative or too large or the memory cannot be had. It never
+// collects; see new_array() for that.
+word_t heap_new(heap *h, word_t count);
+
+// The word holding element index of the array at ref, or NULL when the
+// index is outside it. The interpreter has its own copy of this inline.
+word_t *heap_slot(heap *h, word_t ref, word_t index);
+
+// A collection starts with heap_start_collection(), gets its roots from any
+// number of heap_mark_roots() calls and ends with heap_collect(), which
+// frees every array not reachable from those roots. Nothing may be
+// allocated in between.
+void heap_start_collection(heap *h);
+void heap_mark_roots(heap *h, const word_t *roots, uint32_t count);
+void heap_collect(heap *h);
+
+// Whether ref is not the reference of an array, or of one since collected.
+bool heap_is_freed(heap *h, word_t ref);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef HEAP_STRUCT_H
+#define HEAP_STRUCT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ijvm_types.h"
+
+// A block of heap words. Its size is a power of two, so any offset masked
+// with mask stays inside it.
+typedef struct HEAP_CHUNK {
+  word_t *words;
+  uint32_t mask;
+  uint32_t end;   // the words below end are divided into blocks (see heap.c)
+  uint64_t *bits; // their start, live and mark bitmaps, NULL when not in use
+} heap_chunk;
+
+// Counters of a machine's garbage collector (see get_gc_stats()). The
+// last_ fields describe the most recent collection.
+typedef struct GC_STATS {
+  uint64_t collections;
+  uint64_t last_pause_ns;
+  uint64_t last_reclaimed_bytes;
+  uint64_t max_pause_ns;
+  uint64_t total_pause_ns;
+  uint64_t total_reclaimed_bytes;
+  size_t live_bytes; // in arrays not collected yet
+  size_t heap_bytes; // in chunks
+} gc_stats;
+
+// One free list per power of two up to a whole chunk
+#define HEAP_CLASSES 17
+
+// The arrays of a machine (see heap.h)
+typedef struct HEAP {
+  heap_chunk *chunks;
+  uint32_t chunk_mask;  // chunks has chunk_mask + 1 entries
+  uint32_t chunk_count; // of which these are in use, the empty chunk 0 included
+  uint32_t current;     // the chunk small arrays are bumped from, 0 for none yet
+
+  // Free blocks of at least 2^c words are linked from free[c], and the bit c
+  // of free_classes is set when there are any
+  word_t free[HEAP_CLASSES];
+  uint32_t free_classes;
+
+  // Indices below chunk_count whose chunk was given back
+  uint32_t *spare;
+  uint32_t spare_count;
+  uint32_t spare_size;
+
+  // The mark phase's worklist, kept from one collection to the next, with
+  // the arrays marked but not scanned yet, whether it could not grow, and
+  // when the collection under way started
+  word_t *marking;
+  uint32_t marking_size;
+  uint32_t pending;
+  bool incomplete;
+  uint64_t started_ns;
+
+  // Words allocated since the last collection, and after how many the
+  // next one is due
+  size_t allocated;
+  size_t threshold;
+
+  gc_stats stats;
+} heap;
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef IJVM_EXT_H
+#define IJVM_EXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ijvm.h"
+
+// Additions to the interface in ijvm.h, which has to stay as handed out.
+
+// Like init_ijvm(), for a binary of len bytes at buf rather than a file. The
+// binary goes through the same checks as one loaded from disk, and buf may
+// be freed as soon as the call returns. Native code built with IJVM_AOT=1 is
+// cached in $TMPDIR (or /tmp) since there is no binary to put it next to.
+ijvm *init_ijvm_from_memory(const uint8_t *buf, size_t len, FILE *input, FILE *output);
+
+// Like init_ijvm_from_memory(), but the text section is not copied: the
+// machine keeps pointing into buf, which has to stay valid and unchanged
+// until destroy_ijvm().
+ijvm *init_ijvm_from_memory_borrowed(const uint8_t *buf, size_t len, FILE *input,
+                                     FILE *output);
+
+// A loaded program that any number of machines can run at the same time,
+// from any threads. It holds the constant and text sections, the decoded
+// instruction stream and the method table, none of which change once
+// loading is done, so machines attached to it only carry their own pc,
+// stack and frames. Programs are reference counted: every load_program*()
+// and retain_program() is matched by a release_program(), and every
+// attached machine holds a reference until destroy_ijvm(). They return NULL
+// when the binary cannot be read or is malformed.
+ijvm_program *load_program(const char *binary_path);
+
+// Like load_program(), with the same copy and borrow rules as
+// init_ijvm_from_memory() and init_ijvm_from_memory_borrowed().
+ijvm_program *load_program_from_memory(const uint8_t *buf, size_t len);
+ijvm_program *load_program_from_memory_borrowed(const uint8_t *buf, size_t len);
+
+ijvm_program *retain_program(ijvm_program *p);
+void release_program(ijvm_program *p);
+
+// Number of references currently held on p.
+unsigned int get_program_references(ijvm_program *p);
+
+// Whether p passed the load-time verifier. Machines run verified programs
+// without any runtime checks and on the native tiers when enabled; the
+// others are interpreted with every instruction checked, and stop with an
+// error where the program would misbehave.
+bool is_program_verified(ijvm_program *p);
+
+// Like init_ijvm(), for an already loaded program. The machine takes a
+// reference of its own, so the caller may release p straight away.
+ijvm *init_ijvm_from_program(ijvm_program *p, FILE *input, FILE *output);
+
+// Like init_ijvm_from_program(), with IN and OUT going through the channels
+// in io instead of FILEs (see io_struct.h), which io is copied from. in_data
+// has to stay valid until the machine is destroyed or has read past it.
+// Without out_write() the output is collected in memory for get_output().
+ijvm *init_ijvm_with_io(ijvm_program *p, const ijvm_io *io);
+
+// Counters of the program cache, which load_program() and init_ijvm() go
+// through once it has a limit. bytes is the footprint of the programs it
+// holds, evictions counts the ones dropped to stay under limit.
+typedef struct PROGRAM_CACHE_STATS {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint32_t entries;
+  size_t bytes;
+  size_t limit;
+} program_cache_stats;
+
+// Caps the program cache at bytes, evicting least recently used programs
+// as needed. 0 turns the cache off and empties it. Without a call the limit
+// is taken from IJVM_PROGRAM_CACHE, in MiB, and the cache is off when that
+// is unset.
+void set_program_cache_limit(size_t bytes);
+
+void get_program_cache_stats(program_cache_stats *out);
+
+// Runs up to n instructions, as n calls to step() would, but without
+// returning to the caller in between. Returns how many actually ran, which
+// is less than n only when the machine finished.
+uint64_t step_n(ijvm *m, uint64_t n);
+
+// Where run_until() stops: before the instruction at pc, or before any
+// instruction whose opcode byte (see get_instruction()) is opcode. Either
+// may be -1 to leave it out.
+typedef struct IJVM_BREAKPOINT {
+  word_t pc;
+  int opcode;
+} ijvm_breakpoint;
+
+// Runs until the next instruction matches at, the machine finishes or budget
+// instructions have run, whichever comes first, and returns how many ran. at
+// is tested before every instruction including the first, so a machine
+// already stopped there runs nothing. Native code is not used.
+uint64_t run_until(ijvm *m, const ijvm_breakpoint *at, uint64_t budget);
+
+// Fuel bounds the number of instructions a machine runs, one unit each.
+// run() charges a stretch of instructions that can only be left at its end
+// as it enters it, so it stops before a stretch the remaining fuel does not
+// cover in full, possibly with some left over; step(), step_n() and
+// run_until() charge every instruction. A machine that runs out is
+// finished, and is_out_of_fuel() tells it apart from one that halted or
+// failed. Giving it more fuel lets it continue. Machines start with
+// IJVM_FUEL_UNLIMITED, which is never used up; any other amount keeps run()
+// on the interpreter.
+#define IJVM_FUEL_UNLIMITED UINT64_MAX
+
+void set_fuel(ijvm *m, uint64_t fuel);
+uint64_t get_fuel(ijvm *m);
+bool is_out_of_fuel(ijvm *m);
+
+// OUT goes through a buffer of IJVM_OUT_BUFFER bytes per machine (8192
+// unless set, 0 for none) that is flushed when full, before IN waits for
+// input and by the time run(), step(), step_n() or run_until() return, so it
+// only ever holds bytes while the machine is running. set_output_buffer()
+// flushes and resizes it, returning false and leaving the machine unbuffered
+// when that fails. flush_output() hands the buffered bytes on straight away.
+//
+// IN reads ahead in blocks, through the FILE, so bytes the caller left in its
+// buffer are read first. Input from a pipe, terminal or socket is taken as
+// soon as any of it arrives. Once the machine finishes, the bytes it read
+// ahead but did not use are given back to the FILE, where the caller or a
+// later machine finds them. A file is seeked back; a pipe, terminal or
+// socket gets them back through ungetc(), which some C libraries limit to a
+// few bytes, so callers that share such a stream with a machine should not
+// count on more than one.
+bool set_output_buffer(ijvm *m, size_t size);
+void flush_output(ijvm *m);
+
+// The output a machine from init_ijvm_with_io() without out_write() has
+// collected, and its length in *len; it stays valid until the next
+// instruction runs. NULL for other machines. set_output_buffer() only
+// reserves room here. clear_output() drops what was collected.
+const uint8_t *get_output(ijvm *m, size_t *len);
+void clear_output(ijvm *m);
+
+// Counters of the machine's garbage collector (see gc_stats in
+// heap_struct.h). Collections run on GC, when NEWARRAY finds that as much
+// has been allocated since the last one as that one left alive (at least
+// 4 MiB), and when NEWARRAY finds the heap full.
+void get_gc_stats(ijvm *m, gc_stats *out);
+
+// Where the operand stacks of machines live. A grown stack is a heap block
+// that doubles whenever it is full, so pushes have to check for room. A
+// virtual stack is a large reservation that is committed as it is touched
+// and ends the machine when it overflows into its guard region (see
+// vstack.h), so they need not; it falls back to a grown stack where it is
+// not supported.
+typedef enum IJVM_STACK_BACKEND {
+  IJVM_STACK_DEFAULT, // virtual with IJVM_VSTACK=1, grown otherwise
+  IJVM_STACK_GROWN,
+  IJVM_STACK_VIRTUAL,
+} ijvm_stack_backend;
+
+// Picks the backend of every machine initialised from now on, in any
+// thread. Machines already running keep theirs.
+void set_stack_backend(ijvm_stack_backend backend);
+ijvm_stack_backend get_stack_backend(void);
+
+// Bytes of memory currently backing the operand stack and the frame stack.
+// For a virtual stack only the pages touched so far count.
+size_t get_stack_committed_bytes(ijvm *m);
+
+#endif
@@ -4,16 +4,52 @@
 #include <stdbool.h>
 #include "ijvm.h"
 
-bool read_magic_number(ijvm *m, FILE *fp);
-bool read_constant_pool(ijvm *m, FILE *fp);
-bool read_text_section(ijvm *m, FILE *fp);
+bool read_magic_number(ijvm_program *p, FILE *fp);
+bool read_constant_pool(ijvm_program *p, FILE *fp);
+bool read_text_section(ijvm_program *p, FILE *fp);
 
-void initialize_stack(ijvm *m);
+// Sets up the operand and frame stacks, on a virtual stack (see vstack.h)
+// when use_vstack is set and the platform supports it
+void initialize_stack(ijvm *m, bool use_vstack);
 
 word_t pop(ijvm *m);
+
+// Pushes without checking for room: the caller has reserved it, or the
+// stack is mapped and overflows into its guard region
 void push(ijvm *m, word_t value);
 
-int16_t get_short_arg(ijvm *m);
+// Makes room for count more words on the stack. A mapped stack cannot grow,
+// so there this ends the machine instead (see vstack_overflow()).
+void reserve_stack(ijvm *m, uint32_t count);
+void push_frame(ijvm *m, frame f);
+
+// Where the current frame's locals end and its operands start on the stack
+typedef struct FRAME_BOUNDS {
+    uint32_t locals_end;
+    uint32_t base;
+} frame_bounds;
+
+// Fills b for the current frame. It changes with every call and return.
+void get_frame_bounds(ijvm *m, frame_bounds *b);
+
+// Whether the instruction at pc can run without reading or writing outside
+// the current frame, described by b, the text or the constant pool. This is
+// the checked path for programs the verifier rejected (see verify.h):
+// unknown and truncated instructions, stack underflow, out of range locals
+// and constants and unresolved calls are all errors.
+bool check_insn(ijvm *m, const frame_bounds *b);
+
+// NEWARRAY's allocation: collects first when one is due, and again when
+// the heap has no room left. The stack has to be up to date in m, since it
+// holds the roots. Returns 0 when there is no array to be had.
+word_t new_array(ijvm *m, word_t count);
+
+// Collects the arrays not reachable from the stack.
+void collect_garbage(ijvm *m);
+
+// step() without flushing OUT afterwards, for the native tiers to fall back
+// on in the middle of a run
+void step_buffered(ijvm *m);
 
 void perform_bipush(ijvm *m);
 void perform_dup(ijvm *m);
@@ -24,6 +60,10 @@ void perform_isub(ijvm *m);
 void perform_nop(ijvm *m);
 void perform_pop(ijvm *m);
 void perform_swap(ijvm *m);
+void perform_newarray(ijvm *m);
+void perform_iaload(ijvm *m);
+void perform_iastore(ijvm *m);
+void perform_gc(ijvm *m);
 void perform_err(ijvm *m);
 void perform_halt(ijvm *m);
 void perform_in(ijvm *m);
@@ -36,7 +76,6 @@ void perform_ldc_w(ijvm *m);
 void perform_iload(ijvm *m);
 void perform_istore(ijvm *m);
 void perform_iinc(ijvm *m);
-void perform_wide(ijvm *m);
 void perform_invokevirtual(ijvm *m);
 void perform_ireturn(ijvm *m);
 
@@ -6,6 +6,12 @@
 
 #include "ijvm_types.h"
 #include "stack_struct.h"
+#include "insn_struct.h"
+#include "frame_struct.h"
+#include "method_struct.h"
+#include "program_struct.h"
+#include "io_struct.h"
+#include "heap_struct.h"
 /**
  * All the state of your IJVM machine goes in this struct!
  **/
@@ -17,24 +23,62 @@ typedef struct IJVM {
     FILE *out;  // use for example fprintf(ijvm->out, "%c", value); to print value to out
 
   // your variables go here
-  uint32_t magic_num;
-  // Constant Pool
-  uint32_t constant_origin;
+  // The shared program the machine runs (see ijvm_ext.h)
+  ijvm_program *program;
+
+  // Copied from program when attaching, so the hot paths reach them
+  // without going through it
   uint32_t constant_size;
   word_t *constant_data;
-
-  // Text Pool
-  uint32_t text_origin;
   uint32_t text_size;
   uint8_t *text_data;
+  insn *code;
+  uint32_t *run_cost;
+  method *methods;
+  uint32_t method_count;
+
+  // Whether instructions are checked before they run, because the program
+  // failed the verifier or IJVM_CHECKED asked for it
+  bool checked;
 
   // Program Counter
   word_t pc;
   word_t lv;
   bool is_finished;
 
+  // Instructions the machine may still run, and whether it stopped because
+  // there were not enough (see ijvm_ext.h)
+  uint64_t fuel;
+  bool out_of_fuel;
+
   // Stack
   stack *st;
+  call_stack *frames;
+  bool fill_locals; // whether invocations initialise their locals
+
+  // Arrays made by NEWARRAY (see heap.h)
+  heap heap;
+
+  // Channels used instead of in and out when those are NULL; the input
+  // part is advanced as it is used (see io.h)
+  ijvm_io io;
+
+  // Bytes written by OUT and not yet passed on to out (see io.h)
+  uint8_t *out_buffer;
+  uint32_t out_used;
+  uint32_t out_size;
+
+  // Input read ahead, either into in_block or straight from io.in_data, and
+  // whether in is a pipe, terminal or socket (see io.h)
+  const uint8_t *in_buffer;
+  uint32_t in_pos;
+  uint32_t in_end;
+  uint8_t *in_block;
+  bool in_stream;
+
+  // Native code tiers, NULL unless enabled (see jit.h and aot.h)
+  struct JIT *jit;
+  struct AOT *aot;
 
 
 
@@ -0,0 +1,45 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdbool.h>
+#include "ijvm.h"
+
+// Optional on-disk cache of the work done on a program after loading it:
+// the decoded, fused and quickened instruction stream, the method table
+// with its stack depths and the verifier's verdict. It is written next to
+// the binary as binary.cache the first time the binary is loaded, and
+// later loads map it and point the program straight into the mapping
+// instead of decoding again. A cache file records a hash of the binary's
+// sections and is ignored once they change, as well as when it comes from
+// another version of the format or a machine with a different struct
+// layout. It is also ignored, and rebuilt, once it has been written in
+// place: its header records the mtime it was given when stored. Nothing
+// past the header is checked, so loads stay at one mmap; a cache file that
+// passes is trusted like the binary itself, and code and methods run
+// straight from the mapping. It is opened without following symlinks and
+// must not be changed while a program uses it. Selected with
+// IJVM_IMAGE_CACHE=1.
+
+// Bumped whenever the layout of the file, insn or method changes
+#define IMAGE_VERSION 7
+
+bool image_cache_enabled(void);
+
+// Fills the code and method table of p, whose sections are loaded, from
+// p->path's cache file. Returns false, leaving p alone, when there is no
+// usable cache file.
+bool image_cache_load(ijvm_program *p);
+
+// Writes the cache file of p, which must be fully set up. Failing to write
+// it is not an error.
+void image_cache_store(const ijvm_program *p);
+
+// Unmaps what image_cache_load() mapped.
+void image_cache_unload(ijvm_program *p);
+
+// Whether the cache file p was loaded from has been written in place since,
+// and with it what p's code and methods point at. Only meaningful for a
+// program with an image.
+bool image_cache_changed(const ijvm_program *p);
+
+#endif
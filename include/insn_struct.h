@@ -0,0 +1,18 @@
+#ifndef INSN_STRUCT_H
+#define INSN_STRUCT_H
+
+#include "ijvm_types.h"
+
+// One entry of the pre-decoded instruction stream. The stream is indexed by
+// byte offset into the text section, so the program counter keeps its
+// meaning and a jump to any offset lands on a decoded entry.
+typedef struct INSN {
+  uint8_t op;   // decoded_op, see decode.h
+  uint8_t xop;  // op executed by run(), possibly a fused superinstruction
+  uint8_t len;  // size of the encoded instruction in bytes
+  word_t a;     // immediate, local index, constant index or absolute branch target
+  word_t b;     // second operand (the IINC increment), or the value resolved by quickening
+  word_t c;     // method table index of a quick INVOKEVIRTUAL
+} insn;
+
+#endif 
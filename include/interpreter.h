@@ -0,0 +1,50 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "ijvm.h"
+
+// The bulk execution engine behind run(). Handlers are laid out in a single
+// function and jump straight to the next handler through a label table
+// (computed goto) when the compiler supports it, or through a switch
+// otherwise. Define IJVM_NO_COMPUTED_GOTO to force the portable variant.
+
+#if defined(__GNUC__) && !defined(IJVM_NO_COMPUTED_GOTO)
+#define IJVM_COMPUTED_GOTO 1
+#else
+#define IJVM_COMPUTED_GOTO 0
+#endif
+
+// All the loops are built from the handlers in interpreter_loop.h.
+
+// Runs the machine until it halts, errors or leaves the text section. Only
+// for verified programs (see verify.h): nothing is checked on the way.
+void run_threaded(ijvm *m);
+
+// Like run_threaded(), but checks every instruction before running it (see
+// check_insn()) and stops the machine at the first one that fails. For
+// everything else.
+void run_threaded_checked(ijvm *m);
+
+// Bounds a run of the counted loops below, which stop before running an
+// instruction when budget instructions have already run, when it is at pc
+// or when its opcode byte is opcode. -1 disables pc and opcode.
+typedef struct RUN_LIMIT {
+  uint64_t budget;
+  word_t pc;
+  int opcode;
+  uint64_t executed; // instructions run so far, updated as they run
+} run_limit;
+
+// run_threaded() and run_threaded_checked() under a limit. Short of it, they
+// stop where those would.
+void run_threaded_limited(ijvm *m, run_limit *limit);
+void run_threaded_checked_limited(ijvm *m, run_limit *limit);
+
+// The loops above for machines on a virtual stack (see vstack.h), which push
+// without checking for room. Only to be called under vstack_protect().
+void run_threaded_mapped(ijvm *m);
+void run_threaded_checked_mapped(ijvm *m);
+void run_threaded_limited_mapped(ijvm *m, run_limit *limit);
+void run_threaded_checked_limited_mapped(ijvm *m, run_limit *limit);
+
+#endif
@@ -0,0 +1,517 @@
+// The handlers of the threaded interpreter. Deliberately without an include
+// guard: interpreter.c includes this file once per loop, with RUN_LOOP set
+// to the name of the function to define and CHECKED, COUNTED and MAPPED to
+// 0 or 1.
+//
+// With CHECKED set, every instruction is checked before it runs the same way
+// check_insn() does, and the machine stops at the first one that fails:
+// truncated and unknown instructions, unresolved constants and calls,
+// locals outside the current frame, too few operands for the frame and
+// jumps out of the text. Without it, nothing is checked and the program must have passed the verifier.
+//
+// With COUNTED set, the loop takes a run_limit, counts the instructions it
+// runs in it and returns before the first one the limit excludes, leaving
+// the machine running. Every instruction then goes through the dispatch
+// label, where the limit is tested and fuel is paid one unit at a time.
+// Without it, fuel is paid for a whole run (see measure_runs()) on entering
+// it: at the start, at jump targets and after branches not taken.
+// Superinstructions are only used when neither is set.
+//
+// With MAPPED set, the loop is for machines on a virtual stack and pushes
+// without checking for room, leaving overflow to the guard region.
+
+#define FUSED (!CHECKED && !COUNTED)
+
+#if COUNTED || !IJVM_COMPUTED_GOTO
+#define DISPATCH() goto dispatch
+#else
+#define DISPATCH() goto *labels[ip->xop]
+#endif
+
+#if COUNTED
+#define CHARGE(t)
+#else
+#define CHARGE(t) \
+  do { \
+    if (run_cost[t] > fuel) \
+    { \
+      ip = &code[t]; \
+      OUT_OF_FUEL(); \
+    } \
+    fuel -= run_cost[t]; \
+  } while (0)
+#endif
+
+#define NEXT_RUN(n) \
+  do { \
+    ip += (n); \
+    CHARGE(ip - code); \
+    DISPATCH(); \
+  } while (0)
+
+// Stops the machine at ip, which the checked loop does for every check that
+// fails and both do for array accesses out of bounds
+#define FAIL() \
+  do { \
+    SAVE(); \
+    m->is_finished = true; \
+    return; \
+  } while (0)
+
+#if CHECKED
+#define COMPLETE() \
+  do { \
+    if ((uint32_t)(ip - code) + ip->len > size) \
+      FAIL(); \
+  } while (0)
+#define OPERANDS(n) \
+  do { \
+    if (top < bounds.base + (uint32_t)(n)) \
+      FAIL(); \
+  } while (0)
+#define LOCAL(i) \
+  do { \
+    if ((uint32_t)lv + (uint32_t)(i) >= bounds.locals_end) \
+      FAIL(); \
+  } while (0)
+#define JUMP(t) \
+  do { \
+    pc = (t); \
+    if ((uint32_t)pc >= size) \
+      goto out; \
+    CHARGE(pc); \
+    ip = &code[pc]; \
+    DISPATCH(); \
+  } while (0)
+#else
+#define COMPLETE()
+#define OPERANDS(n)
+#define LOCAL(i)
+// the verifier made sure targets lie inside the text or at its end, where
+// the padding takes over again
+#define JUMP(t) \
+  do { \
+    pc = (t); \
+    CHARGE(pc); \
+    ip = &code[pc]; \
+    DISPATCH(); \
+  } while (0)
+#endif
+
+#if COUNTED
+void RUN_LOOP(ijvm *m, run_limit *limit)
+#else
+void RUN_LOOP(ijvm *m)
+#endif
+{
+#if IJVM_COMPUTED_GOTO
+#if FUSED
+  static const void *labels[D_COUNT] = {DECODED_OPS(FUSED_LABEL)};
+#else
+  static const void *labels[D_COUNT] = {DECODED_OPS(UNFUSED_LABEL)};
+#endif
+#endif
+
+  insn *const code = m->code;
+#if !COUNTED
+  const uint32_t *run_cost = m->run_cost;
+#endif
+  uint64_t fuel = m->fuel;
+#if !CHECKED
+  const word_t *constants = m->constant_data;
+#endif
+  const uint32_t size = m->text_size;
+  const insn *ip;
+  word_t pc;
+  uint32_t top;
+  word_t *data;
+  word_t lv;
+  word_t cache;
+  word_t a, b;
+  frame *fr;
+  const method *callee;
+  const heap_chunk *chunk;
+  uint32_t at;
+  word_t *slot;
+#if CHECKED
+  frame_bounds bounds;
+#endif
+
+  if (m->is_finished)
+    return;
+  LOAD();
+  pc = m->pc;
+  if ((uint32_t)pc >= size)
+    goto out;
+  ip = &code[pc];
+#if CHECKED
+  get_frame_bounds(m, &bounds);
+#endif
+  CHARGE(pc);
+
+#if COUNTED || !IJVM_COMPUTED_GOTO
+dispatch:
+#endif
+#if COUNTED
+  pc = (word_t)(ip - code);
+  if ((uint32_t)pc >= size)
+    goto out;
+  if (limit->executed == limit->budget || pc == limit->pc || m->text_data[pc] == limit->opcode)
+  {
+    SAVE();
+    return;
+  }
+  if (fuel == 0)
+    OUT_OF_FUEL();
+  fuel--;
+  limit->executed++;
+#endif
+#if IJVM_COMPUTED_GOTO
+  goto *labels[ip->xop];
+#elif FUSED
+  switch ((decoded_op)ip->xop)
+  {
+#else
+  switch ((decoded_op)unfused[ip->xop])
+  {
+#endif
+
+  TARGET(BIPUSH)
+    COMPLETE();
+    PUSH(ip->a);
+    NEXT(2);
+
+  TARGET(DUP)
+    OPERANDS(1);
+    PUSH(cache);
+    NEXT(1);
+
+  TARGET(IADD)
+    OPERANDS(2);
+    top--;
+    cache = (word_t)((uint32_t)data[top - 1] + (uint32_t)cache);
+    NEXT(1);
+
+  TARGET(IAND)
+    OPERANDS(2);
+    top--;
+    cache = data[top - 1] & cache;
+    NEXT(1);
+
+  TARGET(IOR)
+    OPERANDS(2);
+    top--;
+    cache = data[top - 1] | cache;
+    NEXT(1);
+
+  TARGET(ISUB)
+    OPERANDS(2);
+    top--;
+    cache = (word_t)((uint32_t)data[top - 1] - (uint32_t)cache);
+    NEXT(1);
+
+  TARGET(NOP)
+    NEXT(1);
+
+  TARGET(POP)
+    OPERANDS(1);
+    DROP();
+    NEXT(1);
+
+  TARGET(SWAP)
+    OPERANDS(2);
+    a = data[top - 2];
+    data[top - 2] = cache;
+    cache = a;
+    NEXT(1);
+
+  // The reference is on top, the index below it and for IASTORE the value
+  // below that. Nothing is popped before the access is known to be good.
+  // Allocation leaves the loop only when a collection is due or the heap
+  // is full, and the collector needs the stack in memory then
+  TARGET(NEWARRAY)
+    OPERANDS(1);
+    a = HEAP_COLLECTION_DUE(&m->heap) ? 0 : heap_new(&m->heap, cache);
+    if (a == 0)
+    {
+      SPILL();
+      a = new_array(m, cache);
+      if (a == 0)
+        FAIL();
+    }
+    cache = a;
+    NEXT(1);
+
+  TARGET(IALOAD)
+    OPERANDS(2);
+    ELEMENT(cache, data[top - 2]);
+    DROP();
+    cache = *slot;
+    NEXT(1);
+
+  TARGET(IASTORE)
+    OPERANDS(3);
+    ELEMENT(cache, data[top - 2]);
+    *slot = data[top - 3];
+    top -= 3;
+    cache = data[top - 1];
+    NEXT(1);
+
+  TARGET(GC)
+    SPILL();
+    collect_garbage(m);
+    NEXT(1);
+
+  TARGET(ERR)
+    SAVE();
+    perform_err(m);
+    return;
+
+  TARGET(HALT)
+    ip++;
+    SAVE();
+    m->is_finished = true;
+    return;
+
+  TARGET(IN)
+    if (m->in_pos < m->in_end)
+      a = m->in_buffer[m->in_pos++];
+    else
+      a = io_get(m);
+    PUSH(a == EOF ? 0 : a);
+    NEXT(1);
+
+  TARGET(OUT)
+    OPERANDS(1);
+    POP_INTO(a);
+    if (m->out_used < m->out_size)
+      m->out_buffer[m->out_used++] = (uint8_t)a;
+    else
+      io_put(m, (uint8_t)a);
+    NEXT(1);
+
+  TARGET(GOTO)
+    COMPLETE();
+    JUMP(ip->a);
+
+  TARGET(IFEQ)
+    COMPLETE();
+    OPERANDS(1);
+    POP_INTO(a);
+    if (a == 0)
+      JUMP(ip->a);
+    NEXT_RUN(3);
+
+  TARGET(IFLT)
+    COMPLETE();
+    OPERANDS(1);
+    POP_INTO(a);
+    if (a < 0)
+      JUMP(ip->a);
+    NEXT_RUN(3);
+
+  TARGET(IF_ICMPEQ)
+    COMPLETE();
+    OPERANDS(2);
+    POP_INTO(a);
+    POP_INTO(b);
+    if (a == b)
+      JUMP(ip->a);
+    NEXT_RUN(3);
+
+  // LDC_W and INVOKEVIRTUAL are quickened when the program is loaded, so
+  // they only get here when they could not be resolved
+  TARGET(LDC_W)
+#if CHECKED
+    FAIL();
+#else
+    PUSH(constants[ip->a]);
+    NEXT(3);
+#endif
+
+  TARGET(LDC_W_QUICK)
+    COMPLETE();
+    PUSH(ip->b);
+    NEXT(3);
+
+  // ILOAD, ISTORE and IINC may carry a folded WIDE prefix, so their length
+  // is taken from the decoded entry
+  TARGET(ILOAD)
+    COMPLETE();
+    LOCAL(ip->a);
+    PUSH(data[lv + ip->a]);
+    NEXT(ip->len);
+
+  TARGET(ISTORE)
+    COMPLETE();
+    OPERANDS(1);
+    LOCAL(ip->a);
+    POP_INTO(a);
+    data[lv + ip->a] = a;
+    NEXT(ip->len);
+
+  TARGET(IINC)
+    COMPLETE();
+    LOCAL(ip->a);
+    a = lv + ip->a;
+    data[a] = (word_t)((uint32_t)data[a] + (uint32_t)ip->b);
+    NEXT(ip->len);
+
+  TARGET(INVOKEVIRTUAL)
+#if CHECKED
+    FAIL();
+#else
+    SAVE();
+    perform_invokevirtual(m);
+    LOAD();
+    JUMP(m->pc);
+#endif
+
+  // Builds the same frame as perform_invokevirtual() without leaving the
+  // loop, unless the operand or frame stack has to grow first
+  TARGET(INVOKEVIRTUAL_QUICK)
+    COMPLETE();
+    callee = &m->methods[ip->c];
+    OPERANDS(callee->args);
+    if (top + callee->reserve > m->st->size || m->frames->depth >= m->frames->size)
+    {
+      SAVE();
+      perform_invokevirtual(m);
+      LOAD();
+#if CHECKED
+      get_frame_bounds(m, &bounds);
+#endif
+      JUMP(m->pc);
+    }
+    data[top - 1] = cache;
+    if (m->fill_locals)
+    {
+      for (uint32_t i = 0; i < callee->locals; i++)
+        data[top + i] = -69;
+    }
+    top += callee->locals;
+    fr = &m->frames->data[m->frames->depth++];
+    fr->return_pc = (word_t)(ip - code) + 3;
+    fr->lv = lv;
+    fr->height = top - callee->locals - callee->args;
+    fr->method = callee->entry - 4;
+#if CHECKED
+    bounds.locals_end = top;
+    bounds.base = top + 1;
+#endif
+    top++;
+    cache = 0;
+    m->lv = lv = (word_t)fr->height;
+    JUMP(callee->entry);
+
+  // The caller's operands below the frame are all in memory, so returning
+  // only moves top and keeps the return value in cache
+  TARGET(IRETURN)
+    OPERANDS(1);
+    if (m->frames->depth == 0)
+    {
+      SAVE();
+      perform_ireturn(m);
+      return;
+    }
+    fr = &m->frames->data[--m->frames->depth];
+    top = fr->height + 1;
+    m->lv = lv = fr->lv;
+#if CHECKED
+    get_frame_bounds(m, &bounds);
+#endif
+    JUMP(fr->return_pc);
+
+  TARGET(END)
+    pc = (word_t)(ip - code);
+    goto out;
+
+#if FUSED
+  // Superinstructions (see fuse_text). ip[k] is the entry of the covered
+  // instruction starting k bytes after the first one.
+  TARGET(ILOAD_ILOAD_IADD)
+    PUSH((word_t)((uint32_t)data[lv + ip->a] + (uint32_t)data[lv + ip[2].a]));
+    NEXT(5);
+
+  TARGET(ILOAD_ILOAD_ISUB)
+    PUSH((word_t)((uint32_t)data[lv + ip->a] - (uint32_t)data[lv + ip[2].a]));
+    NEXT(5);
+
+  TARGET(BIPUSH_IADD)
+    cache = (word_t)((uint32_t)cache + (uint32_t)ip->a);
+    NEXT(3);
+
+  TARGET(BIPUSH_ISUB)
+    cache = (word_t)((uint32_t)cache - (uint32_t)ip->a);
+    NEXT(3);
+
+  TARGET(BIPUSH_IF_ICMPEQ)
+    POP_INTO(a);
+    if (a == ip->a)
+      JUMP(ip[2].a);
+    NEXT_RUN(5);
+
+  TARGET(DUP_IFEQ)
+    if (cache == 0)
+      JUMP(ip[1].a);
+    NEXT_RUN(4);
+
+  TARGET(ILOAD_IFEQ)
+    if (data[lv + ip->a] == 0)
+      JUMP(ip[2].a);
+    NEXT_RUN(5);
+
+  TARGET(ILOAD_IFLT)
+    if (data[lv + ip->a] < 0)
+      JUMP(ip[2].a);
+    NEXT_RUN(5);
+
+  TARGET(ISUB_IFLT)
+    POP_INTO(a);
+    POP_INTO(b);
+    if ((word_t)((uint32_t)b - (uint32_t)a) < 0)
+      JUMP(ip[1].a);
+    NEXT_RUN(4);
+
+  TARGET(IAND_IFEQ)
+    POP_INTO(a);
+    POP_INTO(b);
+    if ((a & b) == 0)
+      JUMP(ip[1].a);
+    NEXT_RUN(4);
+
+  TARGET(IINC_GOTO)
+    a = lv + ip->a;
+    data[a] = (word_t)((uint32_t)data[a] + (uint32_t)ip->b);
+    JUMP(ip[3].a);
+#endif
+
+  // The unchecked loop skips an unknown opcode like a NOP; a verified
+  // program never reaches one
+  DEFAULT_TARGET
+  TARGET(SKIP)
+#if CHECKED
+    FAIL();
+#else
+    NEXT(1);
+#endif
+
+#if !IJVM_COMPUTED_GOTO
+  }
+#endif
+
+out:
+  m->pc = pc;
+  SPILL();
+  m->is_finished = true;
+}
+
+#undef FAIL
+#undef COMPLETE
+#undef OPERANDS
+#undef LOCAL
+#undef JUMP
+#undef CHARGE
+#undef NEXT_RUN
+#undef DISPATCH
+#undef FUSED
@@ -0,0 +1,69 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ijvm.h"
+
+// Character I/O of a machine. OUT appends to a per machine buffer that is
+// written to m->out in one go when it is full, before IN has to wait for
+// input (so prompts show up before the machine waits for an answer) and
+// whenever control goes back to the caller of run(), step(), step_n() or
+// run_until(), which covers HALT and ERR. A buffer size of 0 writes every
+// byte straight through, which is handy when debugging.
+//
+// IN is served from a read-ahead buffer of IN_BUFFER_SIZE bytes, always
+// filled through m->in, so whatever its stdio buffer already holds comes
+// first. Regular files and streams without a file descriptor are refilled
+// with fread(), which only comes back short at the end of the data. Pipes,
+// terminals and sockets wait for one byte and then take only as many more
+// as FIONREAD says have arrived on the descriptor, so input that trickles
+// in is handed to the program as it arrives. Bytes read ahead are given
+// back to m->in once the machine finishes: seeked back over in a file,
+// pushed back with ungetc() into a stream, as far as the C library takes
+// them (one byte is all it has to).
+//
+// Machines whose in or out is NULL use the channels in m->io instead. IN
+// then reads the caller's in_data where it is, then refills from in_read().
+// OUT goes through the buffer to out_write(), or without it stays in a
+// buffer that doubles whenever it is full, until io_clear_output(); bytes
+// that no longer fit (4 GiB, or out of memory) are dropped.
+
+// Buffer size used unless IJVM_OUT_BUFFER gives another one, in bytes
+#define OUT_BUFFER_SIZE 8192
+
+#define IN_BUFFER_SIZE 4096
+
+// Sets up the buffers of a new machine, with the channels in io (NULL for
+// none) for whichever of in and out is NULL.
+void io_init(ijvm *m, const ijvm_io *io);
+
+// Flushes and frees the buffers.
+void io_destroy(ijvm *m);
+
+// Called whenever control goes back to the caller: flushes OUT and, once
+// the machine has finished, puts back the input it read ahead.
+void io_return(ijvm *m);
+
+// Replaces the buffer with one of size bytes, after flushing the old one.
+// Returns false, leaving the machine unbuffered, when it cannot be
+// allocated. Collected output is kept, and only ever grows to size.
+bool io_set_buffer(ijvm *m, size_t size);
+
+// Writes c to OUT. The interpreter inlines the case where it fits.
+void io_put(ijvm *m, uint8_t c);
+
+// Writes whatever OUT has buffered to m->out.
+void io_flush(ijvm *m);
+
+// The output collected so far and its length, NULL when OUT goes elsewhere.
+const uint8_t *io_output(ijvm *m, size_t *len);
+
+// Drops the collected output.
+void io_clear_output(ijvm *m);
+
+// Reads the next byte for IN, EOF when there is none. The interpreter
+// inlines the case where the buffer has it.
+int io_get(ijvm *m);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef IO_STRUCT_H
+#define IO_STRUCT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where a machine started with init_ijvm_with_io() reads IN from and writes
+// OUT to, instead of FILEs (see ijvm_ext.h).
+typedef struct IJVM_IO {
+  // IN takes the in_size bytes at in_data first, then whatever in_read()
+  // puts in buf, until it returns 0. Either may be left out.
+  const uint8_t *in_data;
+  size_t in_size;
+  size_t (*in_read)(void *ctx, uint8_t *buf, size_t len);
+
+  // OUT hands blocks of len bytes to out_write(). Without it, everything
+  // printed is kept in a buffer that grows as needed (see get_output()).
+  void (*out_write)(void *ctx, const uint8_t *buf, size_t len);
+
+  // Passed to both callbacks
+  void *ctx;
+} ijvm_io;
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include "ijvm.h"
+
+// Optional x86-64 template JIT. Code is compiled per region: everything
+// reachable from an entry point (the start of main, a method body, or any
+// pc run() resumes at) without going through a call. Each supported
+// instruction is emitted from a fixed machine code template and branches
+// are patched to point at their targets. Instructions the JIT does not
+// handle (IN, OUT, INVOKEVIRTUAL, IRETURN, HALT, ERR, unknown opcodes and
+// malformed WIDE prefixes) end the native code with pc, lv and the stack
+// written back to the ijvm struct, and are then executed by step().
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define IJVM_HAVE_JIT 1
+#else
+#define IJVM_HAVE_JIT 0
+#endif
+
+// Turns on the JIT for m. Returns false (and leaves m interpreted) when the
+// platform has no JIT support or memory could not be set up.
+bool jit_enable(ijvm *m);
+
+// Releases all native code of m. Safe to call when the JIT is disabled.
+void jit_destroy(ijvm *m);
+
+// Runs the machine until it halts, alternating native code and step().
+void run_jit(ijvm *m);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ijvm.h"
+
+// Fills the magic number and the constant and text sections of p from a
+// binary. The file is mmap'd read-only and text_data points straight into
+// the mapping; only the constant pool is converted to host order, into a
+// buffer of its own. When the file cannot be mapped (a pipe, say) it is
+// read through stdio instead. Section sizes are checked against the size
+// of the binary either way; only the text section may end early, and is
+// then cut to the bytes that are there when loading from memory or a
+// mapped file.
+
+// Loads the binary at path. On failure nothing is left allocated.
+bool load_binary(ijvm_program *p, const char *path);
+
+// Loads a binary of len bytes from buf. text_data is left pointing into
+// buf, which has to outlive p.
+bool load_image(ijvm_program *p, const uint8_t *buf, size_t len);
+
+// Gives p a copy of its own of a text section load_image() borrowed.
+bool own_text(ijvm_program *p);
+
+// Releases what load_binary() or load_image() set up.
+void unload_binary(ijvm_program *p);
+
+#endif
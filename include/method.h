@@ -0,0 +1,25 @@
+#ifndef METHOD_H
+#define METHOD_H
+
+#include <stdbool.h>
+#include "ijvm.h"
+
+// The method table holds main and every method reachable from it through
+// INVOKEVIRTUAL, sorted by entry, so main is always entry 0. Main has no
+// header; its arg count is 0 and its local count is one more than the
+// highest local index it uses.
+//
+// max_stack comes from walking each method's code and tracking the operand
+// stack depth. It is METHOD_STACK_UNKNOWN when the depth at some pc depends
+// on the path taken, the stack underflows, or a call target cannot be
+// resolved. reserve is locals + 1 (the guard word) + max_stack, so one
+// capacity check at the call covers the whole invocation when max_stack is
+// known.
+
+// Builds p->methods from the decoded text. Returns false when out of memory.
+bool build_method_table(ijvm_program *p);
+
+// Index of the method whose first instruction is at entry, or -1.
+int32_t find_method(ijvm_program *p, word_t entry);
+
+#endif
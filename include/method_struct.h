@@ -0,0 +1,19 @@
+#ifndef METHOD_STRUCT_H
+#define METHOD_STRUCT_H
+
+#include "ijvm_types.h"
+
+// Marks a max_stack that could not be worked out at load time
+#define METHOD_STACK_UNKNOWN (-1)
+
+// One entry of the method table (see method.h)
+typedef struct METHOD {
+  word_t entry;       // pc of the first instruction, right after the header
+  uint16_t args;      // argument count from the header, including the object reference
+  uint16_t locals;    // local variable count from the header
+  int32_t max_stack;  // deepest the operand stack of one invocation gets
+  uint32_t reserve;   // stack slots an invocation claims on top of its arguments
+
+} method;
+
+#endif 
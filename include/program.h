@@ -0,0 +1,21 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ijvm.h"
+
+// Library-internal side of the program API in ijvm_ext.h.
+
+// Loads the binary at path, bypassing the program cache.
+ijvm_program *load_program_file(const char *path);
+
+// Bytes of memory held by p: the converted constant pool, the text section
+// when it is a copy or a mapping, the decoded stream and the method table.
+size_t program_footprint(const ijvm_program *p);
+
+// Hash of the constant pool and text section of p, which identifies the
+// binary to the native code and image caches.
+uint64_t program_hash(const ijvm_program *p);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <stdbool.h>
+#include "ijvm.h"
+
+// Optional process-wide cache of programs loaded from files, so that
+// loading the same binary again hands out the program already in memory.
+// Entries are keyed by the identity of the file (device, inode, size and
+// modification time), so a rewritten binary is loaded afresh and every
+// name of the same file shares one entry. The cache holds a reference on
+// each program it keeps and drops the least recently used ones once the
+// footprint of all of them goes over the limit; machines still running an
+// evicted program keep it alive through their own reference.
+//
+// Off until set_program_cache_limit() is called, or IJVM_PROGRAM_CACHE is
+// set to the limit in MiB. All of it is safe to use from several threads.
+
+// Whether load_program() should go through the cache.
+bool program_cache_enabled(void);
+
+// Returns a new reference on the program for the binary at path, loading
+// and adding it on a miss. NULL when the binary cannot be loaded.
+ijvm_program *program_cache_load(const char *path);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef PROGRAM_STRUCT_H
+#define PROGRAM_STRUCT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "ijvm_types.h"
+#include "insn_struct.h"
+#include "method_struct.h"
+
+// Everything about a loaded binary that stays the same while it runs. It is
+// built once, never written afterwards, and shared by every machine attached
+// to it (see ijvm_ext.h).
+typedef struct IJVM_PROGRAM {
+  atomic_uint refs;
+
+  uint32_t magic_num;
+  // Constant Pool
+  uint32_t constant_origin;
+  uint32_t constant_size;
+  word_t *constant_data;
+
+  // Text Pool
+  uint32_t text_origin;
+  uint32_t text_size;
+  uint8_t *text_data;
+  bool text_owned;      // text_data was malloc'd rather than borrowed
+
+  // The mmap'd binary text_data points into, if any (see loader.h)
+  void *mapping;
+  size_t mapping_size;
+
+  // Pre-decoded and quickened text, one entry per byte offset (see decode.h)
+  insn *code;
+  uint32_t *run_cost;   // fuel charged on entering each pc (see measure_runs())
+
+  // Method table, main first (see method.h)
+  method *methods;
+  uint32_t method_count;
+  bool verified;        // passed the verifier (see verify.h)
+
+  // The mapped cache file code and methods point into, if any (see
+  // image_cache.h)
+  void *image;
+  size_t image_size;
+  uint64_t image_dev;   // the identity and mtime of the file it maps, to
+  uint64_t image_ino;   // notice it being written in place
+  int64_t image_mtime;
+  long image_mtime_nsec;
+
+  // The file it was loaded from, NULL for programs loaded from memory
+  char *path;
+} ijvm_program;
+
+#endif 
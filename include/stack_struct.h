@@ -2,12 +2,14 @@
 #ifndef STACK_STRUCT_H
 #define STACK_STRUCT_H
 
+#include <stdbool.h>
 #include "ijvm_types.h"
 
 typedef struct STACK {
   word_t *data;
   uint32_t size;
   uint32_t index_top;
+  bool mapped; // reserved by vstack_create(), never reallocated
 
 } stack;
 
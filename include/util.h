@@ -29,10 +29,28 @@ uint32_t swap_uint32(uint32_t num);
 uint16_t swap_uint16(uint16_t num);
 int32_t swap_int32(int32_t num);
 int16_t swap_int16(int16_t num);
-uint32_t read_uint32(uint8_t* buf) ;
-uint16_t read_uint16(uint8_t* buf) ;
-int32_t read_int32(uint8_t* buf) ;
-int16_t read_int16(uint8_t* buf) ;
+uint32_t read_uint32(const uint8_t *buf) ;
+uint16_t read_uint16(const uint8_t *buf) ;
+int32_t read_int32(const uint8_t *buf) ;
+int16_t read_int16(const uint8_t *buf) ;
+
+// Converts count big-endian words at src to host order in dst. Uses AVX2 or
+// SSSE3 shuffles when the CPU has them (checked once, by the first call from
+// any thread) and the scalar loop otherwise. src needs no alignment and must
+// not overlap dst unless src == (uint8_t *)dst.
+void read_uint32_array(uint32_t *dst, const uint8_t *src, size_t count);
+void read_uint32_array_scalar(uint32_t *dst, const uint8_t *src, size_t count);
+// Name of the variant read_uint32_array() picked: "avx2", "ssse3" or "scalar"
+const char *read_uint32_array_variant(void);
+// Converts with the variant of that name, whatever read_uint32_array()
+// picked. Returns false, leaving dst alone, when this build or CPU does not
+// have it.
+bool read_uint32_array_with(const char *variant, uint32_t *dst, const uint8_t *src,
+                            size_t count);
+
+// 64-bit FNV-1a hash of len bytes, chained through h. Start with HASH_SEED.
+#define HASH_SEED 0xcbf29ce484222325ULL
+uint64_t hash_bytes(const uint8_t *buf, size_t len, uint64_t h);
 
 #if DEBUG_LEVEL >= 1 
 #define dprintf(...) \
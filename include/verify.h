@@ -0,0 +1,34 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdbool.h>
+#include "ijvm.h"
+
+// Load-time bytecode verifier. It walks the code of every method in the
+// method table, tracking the lowest operand stack depth each pc can be
+// reached with, and accepts the program when every instruction reachable
+// in a method
+//  - is complete and defined (no D_SKIP, no operands past the text),
+//  - finds the operands it pops on the stack of its own frame,
+//  - branches inside the text or to its end,
+//  - uses locals of its own frame and constants that exist, and
+//  - calls a method of the table.
+// A verified program can never touch another frame, read past the text or
+// the constant pool or run an undefined instruction, so run() executes it
+// without any checks. The others run on the checked path (see
+// check_insn()). Unlike max_stack in the method table, the depth is not
+// required to be the same on every path, only never to underflow.
+//
+// Only the depth is tracked, never values, so a program whose stack depth
+// depends on the data is rejected even when it never underflows. This is
+// the case when one loop pushes a number of words and another pops until a
+// value says to stop. div() in files/advanced/mandelbread.ijvm is like that:
+// it only unwinds what build_stack pushed, and build_stack pushes at least
+// once because a >= b was checked before. Nothing here can prove that, so
+// mandelbread runs on the checked loop and never on the JIT or AOT code.
+// testprogram lists the shipped programs that do not verify and why.
+
+// Returns whether p passes. Needs the method table and quickened code.
+bool verify_program(const ijvm_program *p);
+
+#endif
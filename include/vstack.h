@@ -0,0 +1,47 @@
+#ifndef VSTACK_H
+#define VSTACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ijvm.h"
+
+// Optional operand stack backend that reserves VSTACK_RESERVE_BYTES of
+// address space up front and lets the OS commit pages as they are first
+// touched, so the stack never moves or gets copied. It is followed by a
+// PROT_NONE guard region larger than any single frame, and a SIGSEGV
+// handler turns a write into it into a machine error: run() or step()
+// returns with the machine finished. Selected with set_stack_backend(), or
+// IJVM_VSTACK=1 for machines left on the default.
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IJVM_HAVE_VSTACK 1
+#else
+#define IJVM_HAVE_VSTACK 0
+#endif
+
+#define VSTACK_RESERVE_BYTES ((size_t)256 << 20)
+
+// Covers the largest bump one INVOKEVIRTUAL makes without a check: 65535
+// locals, the guard word and a max_stack of 65535
+#define VSTACK_GUARD_BYTES ((size_t)1 << 20)
+
+// Maps a virtual stack into st (data and size). Returns false when the
+// platform has no support or the mapping fails.
+bool vstack_create(stack *st);
+
+// Unmaps the stack created by vstack_create().
+void vstack_destroy(stack *st);
+
+// Bytes of the stack actually backed by memory.
+size_t vstack_committed_bytes(const stack *st);
+
+// Calls fn(m, arg) so that a stack overflow on m ends the machine instead of
+// the process.
+void vstack_protect(ijvm *m, void (*fn)(ijvm *m, void *arg), void *arg);
+
+// Ends the machine from inside vstack_protect(); used when a capacity check
+// on a virtual stack fails. Returns only when no protect call is active, in
+// which case the machine is just marked finished.
+void vstack_overflow(ijvm *m);
+
+#endif
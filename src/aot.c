@@ -0,0 +1,336 @@
+// fork, dlopen and friends are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "aot.h"
+#include "ijvm_helper.h"
+#include "decode.h"
+#include "program.h"
+
+// Bumped whenever the generated code or aot_frame changes, so stale cached
+// objects are rejected
+#define AOT_ABI 1
+
+// Must match the frame declared in the generated C below
+typedef struct AOT_FRAME {
+  word_t *sp;    // next free stack slot
+  word_t *lv;    // local variable 0 of the current frame
+  word_t *limit; // one past the last allocated stack slot
+  word_t pc;     // set by native code when it exits
+} aot_frame;
+
+// Returns 0 when pc has no native code, else runs it and returns 1
+typedef int (*aot_enter_fn)(aot_frame *f);
+
+struct AOT {
+  void *handle;
+  aot_enter_fn enter;
+};
+
+static const char PREAMBLE[] =
+    "#include <stdint.h>\n"
+    "typedef struct { int32_t *sp; int32_t *lv; int32_t *limit; int32_t pc; } aot_frame;\n"
+    "#define EXIT(p) do { f->pc = (p); goto out; } while (0)\n"
+    "#define NEED_SLOT(p) do { if (sp >= limit) EXIT(p); } while (0)\n";
+
+// A jump to target: a goto when target belongs to the method, else an exit
+static void emit_jump(ijvm *m, FILE *c, const bool *in_method, word_t target)
+{
+  if ((uint32_t)target < m->text_size && in_method[target])
+    fprintf(c, "goto L%d;\n", target);
+  else
+    fprintf(c, "EXIT(%d);\n", target);
+}
+
+static void emit_binary(FILE *c, const char *op)
+{
+  fprintf(c, "  sp[-2] = (int32_t)((uint32_t)sp[-2] %s (uint32_t)sp[-1]); sp--;\n", op);
+}
+
+static void emit_insn(ijvm *m, FILE *c, const bool *in_method, word_t pc, const insn *in)
+{
+  switch (in->op)
+  {
+  case D_NOP:
+    fprintf(c, "  ;\n");
+    break;
+  case D_BIPUSH:
+    fprintf(c, "  NEED_SLOT(%d); *sp++ = %d;\n", pc, in->a);
+    break;
+  case D_LDC_W:
+    // a constant that does not exist is left to the interpreter to report
+    if (!insn_is_self_contained(m->program, in))
+      fprintf(c, "  EXIT(%d);\n", pc);
+    else
+      fprintf(c, "  NEED_SLOT(%d); *sp++ = %d;\n", pc, m->constant_data[in->a]);
+    break;
+  case D_DUP:
+    fprintf(c, "  NEED_SLOT(%d); sp[0] = sp[-1]; sp++;\n", pc);
+    break;
+  case D_IADD:
+    emit_binary(c, "+");
+    break;
+  case D_ISUB:
+    emit_binary(c, "-");
+    break;
+  case D_IAND:
+    emit_binary(c, "&");
+    break;
+  case D_IOR:
+    emit_binary(c, "|");
+    break;
+  case D_POP:
+    fprintf(c, "  sp--;\n");
+    break;
+  case D_SWAP:
+    fprintf(c, "  { int32_t t = sp[-1]; sp[-1] = sp[-2]; sp[-2] = t; }\n");
+    break;
+  case D_GOTO:
+    fprintf(c, "  ");
+    emit_jump(m, c, in_method, in->a);
+    break;
+  case D_IFEQ:
+    fprintf(c, "  if (*--sp == 0) ");
+    emit_jump(m, c, in_method, in->a);
+    break;
+  case D_IFLT:
+    fprintf(c, "  if (*--sp < 0) ");
+    emit_jump(m, c, in_method, in->a);
+    break;
+  case D_IF_ICMPEQ:
+    fprintf(c, "  sp -= 2; if (sp[0] == sp[1]) ");
+    emit_jump(m, c, in_method, in->a);
+    break;
+  case D_ILOAD:
+    fprintf(c, "  NEED_SLOT(%d); *sp++ = lv[%d];\n", pc, in->a);
+    break;
+  case D_ISTORE:
+    fprintf(c, "  lv[%d] = *--sp;\n", in->a);
+    break;
+  case D_IINC:
+    fprintf(c, "  lv[%d] = (int32_t)((uint32_t)lv[%d] + (uint32_t)(%d));\n", in->a, in->a, in->b);
+    break;
+  default:
+    fprintf(c, "  EXIT(%d);\n", pc);
+    break;
+  }
+}
+
+// Writes the function of the method starting at entry. Its pcs are marked
+// in in_method and listed in pcs, and the ones that get a native entry point
+// and are not claimed by an earlier method are recorded in owner.
+static void emit_method(ijvm *m, FILE *c, word_t entry, bool *in_method, word_t *owner,
+                        word_t *pcs, word_t *worklist)
+{
+  memset(in_method, 0, m->text_size);
+  uint32_t count = collect_reachable(m->program, entry, in_method, pcs, worklist);
+
+  fprintf(c, "\nstatic int method_%d(aot_frame *f)\n{\n", entry);
+  fprintf(c, "  int32_t *sp = f->sp;\n  int32_t *lv = f->lv;\n  int32_t *const limit = f->limit;\n");
+  fprintf(c, "  switch (f->pc)\n  {\n");
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (insn_is_self_contained(m->program, &m->code[pcs[i]]))
+      fprintf(c, "  case %d: goto L%d;\n", pcs[i], pcs[i]);
+  }
+  fprintf(c, "  default: return 0;\n  }\n");
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    word_t pc = pcs[i];
+    const insn *in = &m->code[pc];
+    fprintf(c, "L%d:\n", pc);
+    emit_insn(m, c, in_method, pc, in);
+
+    word_t next = pc + in->len;
+    if (insn_is_self_contained(m->program, in) && insn_falls_through(in) &&
+        (i + 1 == count || pcs[i + 1] != next))
+    {
+      fprintf(c, "  ");
+      emit_jump(m, c, in_method, next);
+    }
+
+    if (owner[pc] < 0 && insn_is_self_contained(m->program, in))
+      owner[pc] = entry;
+  }
+  fprintf(c, "out:\n  f->sp = sp;\n  return 1;\n}\n");
+}
+
+// Translates the program to C, one function per entry of the method table
+static bool translate(ijvm *m, FILE *c)
+{
+  uint32_t size = m->text_size;
+  bool *in_method = (bool *)malloc(size + 1);
+  word_t *owner = (word_t *)malloc(sizeof(word_t) * (size + 1));
+  word_t *pcs = (word_t *)malloc(sizeof(word_t) * (size + 1));
+  word_t *worklist = (word_t *)malloc(sizeof(word_t) * (2 * size + 1));
+  bool ok = in_method && owner && pcs && worklist;
+
+  if (ok)
+  {
+    for (uint32_t pc = 0; pc < size; pc++)
+      owner[pc] = -1;
+
+    fputs(PREAMBLE, c);
+    for (uint32_t i = 0; i < m->method_count; i++)
+    {
+      if ((uint32_t)m->methods[i].entry < size)
+        emit_method(m, c, m->methods[i].entry, in_method, owner, pcs, worklist);
+    }
+
+    fprintf(c, "\nint ijvm_aot_enter(aot_frame *f)\n{\n  switch (f->pc)\n  {\n");
+    for (uint32_t pc = 0; pc < size; pc++)
+    {
+      if (owner[pc] >= 0)
+        fprintf(c, "  case %u: return method_%d(f);\n", pc, owner[pc]);
+    }
+    fprintf(c, "  default: return 0;\n  }\n}\n\nconst int ijvm_aot_abi = %d;\n", AOT_ABI);
+    ok = !ferror(c);
+  }
+
+  free(worklist);
+  free(pcs);
+  free(owner);
+  free(in_method);
+  return ok;
+}
+
+// Runs $IJVM_CC (default clang) to turn c_path into the shared object so_path
+static bool compile(const char *c_path, const char *so_path)
+{
+  const char *cc = getenv("IJVM_CC");
+  if (!cc || !*cc)
+    cc = "clang";
+
+  pid_t pid = fork();
+  if (pid < 0)
+    return false;
+  if (pid == 0)
+  {
+    execlp(cc, cc, "-O2", "-shared", "-fPIC", "-o", so_path, c_path, (char *)NULL);
+    _exit(127);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0)
+    return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Translates and compiles m into so_path. Work files carry the pid so that
+// concurrent runs of the same program do not trip over each other; the
+// finished object is moved into place atomically.
+static bool build(ijvm *m, const char *so_path)
+{
+  size_t len = strlen(so_path) + 32;
+  char *c_path = (char *)malloc(len);
+  char *tmp_path = (char *)malloc(len);
+  bool ok = false;
+
+  if (c_path && tmp_path)
+  {
+    snprintf(c_path, len, "%s.%ld.c", so_path, (long)getpid());
+    snprintf(tmp_path, len, "%s.%ld.tmp", so_path, (long)getpid());
+
+    FILE *c = fopen(c_path, "w");
+    if (c)
+    {
+      ok = translate(m, c);
+      ok = fclose(c) == 0 && ok;
+      ok = ok && compile(c_path, tmp_path) && rename(tmp_path, so_path) == 0;
+      remove(c_path);
+      if (!ok)
+        remove(tmp_path);
+    }
+  }
+
+  free(tmp_path);
+  free(c_path);
+  return ok;
+}
+
+bool aot_enable(ijvm *m, const char *binary_path)
+{
+  // run() keeps checked machines on the checked loop, so there is no point
+  // building anything for them
+  if (m->checked)
+    return false;
+  if (m->aot)
+    return true;
+
+  // programs loaded from memory have no binary to sit next to
+  char tmp_base[4096];
+  if (!binary_path)
+  {
+    const char *dir = getenv("TMPDIR");
+    snprintf(tmp_base, sizeof(tmp_base), "%s/ijvm", dir && *dir ? dir : "/tmp");
+    binary_path = tmp_base;
+  }
+
+  // dlopen only looks in the current directory for paths with a slash
+  const char *prefix = strchr(binary_path, '/') ? "" : "./";
+  size_t len = strlen(binary_path) + 32;
+  char *so_path = (char *)malloc(len);
+  struct AOT *aot = (struct AOT *)malloc(sizeof(struct AOT));
+  if (!so_path || !aot)
+    goto fail;
+  snprintf(so_path, len, "%s%s.%016llx.so", prefix, binary_path,
+           (unsigned long long)program_hash(m->program));
+
+  if (access(so_path, R_OK) != 0 && !build(m, so_path))
+    goto fail;
+
+  aot->handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+  if (!aot->handle)
+    goto fail;
+
+  void *enter = dlsym(aot->handle, "ijvm_aot_enter");
+  const int *abi = (const int *)dlsym(aot->handle, "ijvm_aot_abi");
+  if (!enter || !abi || *abi != AOT_ABI)
+  {
+    dlclose(aot->handle);
+    goto fail;
+  }
+  memcpy(&aot->enter, &enter, sizeof(aot->enter));
+
+  free(so_path);
+  m->aot = aot;
+  return true;
+
+fail:
+  free(aot);
+  free(so_path);
+  return false;
+}
+
+void aot_destroy(ijvm *m)
+{
+  if (!m->aot)
+    return;
+  dlclose(m->aot->handle);
+  free(m->aot);
+  m->aot = NULL;
+}
+
+void run_aot(ijvm *m)
+{
+  while (!finished(m))
+  {
+    word_t *data = m->st->data;
+    aot_frame f = {data + m->st->index_top, data + m->lv, data + m->st->size, m->pc};
+    if (m->aot->enter(&f))
+    {
+      m->st->index_top = (uint32_t)(f.sp - data);
+      m->pc = f.pc;
+      if (finished(m))
+        break;
+    }
+    step_buffered(m);
+  }
+}
@@ -0,0 +1,449 @@
+#include <stdlib.h>
+
+#include "decode.h"
+#include "method.h"
+#include "util.h"
+
+// Operand bytes missing at the end of a truncated text section read as zero.
+static uint8_t byte_at(ijvm_program *p, uint32_t pc)
+{
+  return pc < p->text_size ? p->text_data[pc] : 0;
+}
+
+static uint16_t short_at(ijvm_program *p, uint32_t pc)
+{
+  uint8_t short_bytes[] = {byte_at(p, pc), byte_at(p, pc + 1)};
+  return read_uint16(short_bytes);
+}
+
+void decode_insn(ijvm_program *p, uint32_t pc, insn *out)
+{
+  out->a = 0;
+  out->b = 0;
+  out->c = 0;
+  out->len = 1;
+
+  switch (byte_at(p, pc))
+  {
+  case OP_BIPUSH:
+    out->op = D_BIPUSH;
+    out->a = (int8_t)byte_at(p, pc + 1);
+    out->len = 2;
+    break;
+  case OP_DUP:
+    out->op = D_DUP;
+    break;
+  case OP_ERR:
+    out->op = D_ERR;
+    break;
+  case OP_GOTO:
+    out->op = D_GOTO;
+    out->a = (word_t)pc + (int16_t)short_at(p, pc + 1);
+    out->len = 3;
+    break;
+  case OP_HALT:
+    out->op = D_HALT;
+    break;
+  case OP_IADD:
+    out->op = D_IADD;
+    break;
+  case OP_IAND:
+    out->op = D_IAND;
+    break;
+  case OP_IFEQ:
+    out->op = D_IFEQ;
+    out->a = (word_t)pc + (int16_t)short_at(p, pc + 1);
+    out->len = 3;
+    break;
+  case OP_IFLT:
+    out->op = D_IFLT;
+    out->a = (word_t)pc + (int16_t)short_at(p, pc + 1);
+    out->len = 3;
+    break;
+  case OP_IF_ICMPEQ:
+    out->op = D_IF_ICMPEQ;
+    out->a = (word_t)pc + (int16_t)short_at(p, pc + 1);
+    out->len = 3;
+    break;
+  case OP_IINC:
+    out->op = D_IINC;
+    out->a = byte_at(p, pc + 1);
+    out->b = (int8_t)byte_at(p, pc + 2);
+    out->len = 3;
+    break;
+  case OP_ILOAD:
+    out->op = D_ILOAD;
+    out->a = byte_at(p, pc + 1);
+    out->len = 2;
+    break;
+  case OP_IN:
+    out->op = D_IN;
+    break;
+  case OP_INVOKEVIRTUAL:
+    out->op = D_INVOKEVIRTUAL;
+    out->a = short_at(p, pc + 1);
+    out->len = 3;
+    break;
+  case OP_IOR:
+    out->op = D_IOR;
+    break;
+  case OP_IRETURN:
+    out->op = D_IRETURN;
+    break;
+  case OP_ISTORE:
+    out->op = D_ISTORE;
+    out->a = byte_at(p, pc + 1);
+    out->len = 2;
+    break;
+  case OP_ISUB:
+    out->op = D_ISUB;
+    break;
+  case OP_LDC_W:
+    out->op = D_LDC_W;
+    out->a = short_at(p, pc + 1);
+    out->len = 3;
+    break;
+  case OP_NOP:
+    out->op = D_NOP;
+    break;
+  case OP_OUT:
+    out->op = D_OUT;
+    break;
+  case OP_POP:
+    out->op = D_POP;
+    break;
+  case OP_SWAP:
+    out->op = D_SWAP;
+    break;
+  case OP_NEWARRAY:
+    out->op = D_NEWARRAY;
+    break;
+  case OP_IALOAD:
+    out->op = D_IALOAD;
+    break;
+  case OP_IASTORE:
+    out->op = D_IASTORE;
+    break;
+  case OP_GC:
+    out->op = D_GC;
+    break;
+  case OP_WIDE:
+    out->a = short_at(p, pc + 2);
+    switch (byte_at(p, pc + 1))
+    {
+    case OP_ILOAD:
+      out->op = D_ILOAD;
+      out->len = 4;
+      break;
+    case OP_ISTORE:
+      out->op = D_ISTORE;
+      out->len = 4;
+      break;
+    case OP_IINC:
+      out->op = D_IINC;
+      out->b = (int8_t)byte_at(p, pc + 4);
+      out->len = 5;
+      break;
+    default:
+      // like an unknown opcode, only the WIDE prefix itself is skipped
+      out->op = D_SKIP;
+      out->a = 0;
+      break;
+    }
+    break;
+  default:
+    out->op = D_SKIP;
+    break;
+  }
+  out->xop = out->op;
+}
+
+// Sequences recognised by fuse_text(), longest first. Only the narrow forms
+// of the instructions take part, so every superinstruction finds its
+// operands at fixed offsets.
+typedef struct FUSION {
+  uint8_t ops[3];
+  uint8_t count;
+  uint8_t fused;
+} fusion;
+
+static const fusion fusions[] = {
+    {{D_ILOAD, D_ILOAD, D_IADD}, 3, D_ILOAD_ILOAD_IADD},
+    {{D_ILOAD, D_ILOAD, D_ISUB}, 3, D_ILOAD_ILOAD_ISUB},
+    {{D_BIPUSH, D_IADD}, 2, D_BIPUSH_IADD},
+    {{D_BIPUSH, D_ISUB}, 2, D_BIPUSH_ISUB},
+    {{D_BIPUSH, D_IF_ICMPEQ}, 2, D_BIPUSH_IF_ICMPEQ},
+    {{D_DUP, D_IFEQ}, 2, D_DUP_IFEQ},
+    {{D_ILOAD, D_IFEQ}, 2, D_ILOAD_IFEQ},
+    {{D_ILOAD, D_IFLT}, 2, D_ILOAD_IFLT},
+    {{D_ISUB, D_IFLT}, 2, D_ISUB_IFLT},
+    {{D_IAND, D_IFEQ}, 2, D_IAND_IFEQ},
+    {{D_IINC, D_GOTO}, 2, D_IINC_GOTO},
+};
+
+// Length of the narrow (non-WIDE) encoding of a decoded op
+static uint8_t narrow_len(uint8_t op)
+{
+  switch (op)
+  {
+  case D_BIPUSH:
+  case D_ILOAD:
+  case D_ISTORE:
+    return 2;
+  case D_GOTO:
+  case D_IFEQ:
+  case D_IFLT:
+  case D_IF_ICMPEQ:
+  case D_IINC:
+  case D_INVOKEVIRTUAL:
+  case D_LDC_W:
+    return 3;
+  default:
+    return 1;
+  }
+}
+
+static bool matches(ijvm_program *p, uint32_t pc, const fusion *f)
+{
+  for (uint8_t i = 0; i < f->count; i++)
+  {
+    if (pc >= p->text_size)
+      return false;
+    insn *in = &p->code[pc];
+    if (in->op != f->ops[i] || in->len != narrow_len(in->op))
+      return false;
+    pc += in->len;
+  }
+  return true;
+}
+
+void fuse_text(ijvm_program *p)
+{
+  for (uint32_t pc = 0; pc < p->text_size; pc++)
+  {
+    insn *in = &p->code[pc];
+    in->xop = in->op;
+    for (size_t i = 0; i < sizeof(fusions) / sizeof(fusions[0]); i++)
+    {
+      if (matches(p, pc, &fusions[i]))
+      {
+        in->xop = fusions[i].fused;
+        break;
+      }
+    }
+  }
+}
+
+static bool quicken_insn(ijvm_program *p, insn *in)
+{
+  if ((uint32_t)in->a >= p->constant_size / 4)
+    return false;
+  word_t constant = p->constant_data[in->a];
+
+  switch (in->op)
+  {
+  case D_LDC_W:
+    in->b = constant;
+    in->xop = D_LDC_W_QUICK;
+    return true;
+  case D_INVOKEVIRTUAL:
+  {
+    word_t entry = (word_t)((uint32_t)constant + 4);
+    // main sits at index 0; it has no header and cannot be called
+    int32_t index = find_method(p, entry);
+    if (index <= 0)
+      return false;
+    in->b = entry;
+    in->c = index;
+    in->xop = D_INVOKEVIRTUAL_QUICK;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+void quicken_text(ijvm_program *p)
+{
+  for (uint32_t pc = 0; pc < p->text_size; pc++)
+    quicken_insn(p, &p->code[pc]);
+}
+
+bool insn_is_self_contained(ijvm_program *p, const insn *in)
+{
+  switch (in->op)
+  {
+  case D_NOP:
+  case D_BIPUSH:
+  case D_DUP:
+  case D_GOTO:
+  case D_IADD:
+  case D_IAND:
+  case D_IFEQ:
+  case D_IFLT:
+  case D_IF_ICMPEQ:
+  case D_IINC:
+  case D_ILOAD:
+  case D_IOR:
+  case D_ISTORE:
+  case D_ISUB:
+  case D_POP:
+  case D_SWAP:
+    return true;
+  case D_LDC_W:
+    return (uint32_t)in->a < p->constant_size / 4;
+  default:
+    return false;
+  }
+}
+
+void insn_stack_effect(const insn *in, int32_t *pops, int32_t *pushes)
+{
+  *pops = 0;
+  *pushes = 0;
+  switch (in->op)
+  {
+  case D_BIPUSH:
+  case D_LDC_W:
+  case D_IN:
+  case D_ILOAD:
+  case D_INVOKEVIRTUAL:
+    *pushes = 1;
+    break;
+  case D_DUP:
+    *pops = 1;
+    *pushes = 2;
+    break;
+  case D_NEWARRAY:
+    *pops = 1;
+    *pushes = 1;
+    break;
+  case D_IALOAD:
+    *pops = 2;
+    *pushes = 1;
+    break;
+  case D_IASTORE:
+    *pops = 3;
+    break;
+  case D_SWAP:
+    *pops = 2;
+    *pushes = 2;
+    break;
+  case D_IADD:
+  case D_IAND:
+  case D_IOR:
+  case D_ISUB:
+    *pops = 2;
+    *pushes = 1;
+    break;
+  case D_IF_ICMPEQ:
+    *pops = 2;
+    break;
+  case D_IFEQ:
+  case D_IFLT:
+  case D_OUT:
+  case D_POP:
+  case D_ISTORE:
+  case D_IRETURN:
+    *pops = 1;
+    break;
+  default:
+    break;
+  }
+}
+
+bool measure_runs(ijvm_program *p)
+{
+  uint32_t count = p->text_size + CODE_PADDING;
+  p->run_cost = (uint32_t *)malloc(sizeof(uint32_t) * count);
+  if (!p->run_cost)
+    return false;
+
+  // a run only ever continues to a higher pc
+  for (uint32_t pc = count; pc-- > 0;)
+  {
+    const insn *in = &p->code[pc];
+    if (pc >= p->text_size)
+      p->run_cost[pc] = 0;
+    else if (insn_is_branch(in) || !insn_falls_through(in) || in->op == D_INVOKEVIRTUAL)
+      p->run_cost[pc] = 1;
+    else
+      p->run_cost[pc] = 1 + p->run_cost[pc + in->len];
+  }
+  return true;
+}
+
+bool insn_is_branch(const insn *in)
+{
+  return in->op == D_GOTO || in->op == D_IFEQ || in->op == D_IFLT || in->op == D_IF_ICMPEQ;
+}
+
+bool insn_falls_through(const insn *in)
+{
+  switch (in->op)
+  {
+  case D_GOTO:
+  case D_ERR:
+  case D_HALT:
+  case D_IRETURN:
+  case D_END:
+    return false;
+  default:
+    return true;
+  }
+}
+
+static int compare_pc(const void *x, const void *y)
+{
+  word_t a = *(const word_t *)x;
+  word_t b = *(const word_t *)y;
+  return (a > b) - (a < b);
+}
+
+uint32_t collect_reachable(ijvm_program *p, word_t entry, bool *seen, word_t *out, word_t *worklist)
+{
+  uint32_t count = 0;
+  uint32_t pending = 0;
+
+  worklist[pending++] = entry;
+  while (pending > 0)
+  {
+    word_t pc = worklist[--pending];
+    if ((uint32_t)pc >= p->text_size || seen[pc])
+      continue;
+    seen[pc] = true;
+    out[count++] = pc;
+
+    const insn *in = &p->code[pc];
+    if (insn_is_branch(in))
+      worklist[pending++] = in->a;
+    if (insn_falls_through(in))
+      worklist[pending++] = pc + in->len;
+  }
+
+  qsort(out, count, sizeof(word_t), compare_pc);
+  return count;
+}
+
+bool decode_text(ijvm_program *p)
+{
+  p->code = (insn *)malloc(sizeof(insn) * (p->text_size + CODE_PADDING));
+  if (!p->code)
+    return false;
+
+  for (uint32_t pc = 0; pc < p->text_size; pc++)
+    decode_insn(p, pc, &p->code[pc]);
+
+  for (uint32_t pc = p->text_size; pc < p->text_size + CODE_PADDING; pc++)
+  {
+    p->code[pc].op = D_END;
+    p->code[pc].xop = D_END;
+    p->code[pc].len = 1;
+    p->code[pc].a = 0;
+    p->code[pc].b = 0;
+    p->code[pc].c = 0;
+  }
+
+  fuse_text(p);
+  return true;
+}
@@ -0,0 +1,550 @@
+// clock_gettime is POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "heap.h"
+
+// Chunk 0 and every unused entry of a chunk table: one word reading as a
+// length of 0, so no index ever gets past the check and it is never written
+static word_t no_words[1];
+static heap_chunk no_chunks[1] = {{no_words, 0, 0, NULL}};
+
+// The words of a chunk below its end are divided into blocks, each holding
+// an array or free. Three bitmaps beside the chunk describe them, one bit
+// per word: STARTS has the first word of every block, LIVE those of arrays
+// and MARKS those the running collection has reached. Only words that a
+// reference can name have bits, which leaves a single word of each for the
+// chunks larger than HEAP_CHUNK_WORDS, as they hold one array at offset 0.
+//
+// A free block starts with a length word of 0. Free blocks of at least
+// three words are linked into the free list of their size class, the
+// highest power of two not above their size: their second word holds the
+// size and the third the next block of the list, 0 at its end. A program
+// writing through a forged reference can change these words, and lengths
+// of arrays, so they are never trusted further than the bitmaps and the
+// end of the chunk confirm.
+enum { STARTS, LIVE, MARKS };
+
+#define NONE UINT32_MAX
+
+static uint32_t bitmap_words(const heap_chunk *c)
+{
+  uint32_t size = c->mask + 1;
+  return size > HEAP_CHUNK_WORDS ? 1 : size / 64;
+}
+
+static uint64_t *bitmap(const heap_chunk *c, int which)
+{
+  return c->bits + (size_t)which * bitmap_words(c);
+}
+
+static bool test_bit(const uint64_t *map, uint32_t i)
+{
+  return map[i / 64] >> (i % 64) & 1;
+}
+
+static void set_bit(uint64_t *map, uint32_t i)
+{
+  map[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static void clear_bit(uint64_t *map, uint32_t i)
+{
+  map[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+static word_t make_ref(uint32_t chunk, uint32_t at)
+{
+  return (word_t)(chunk << HEAP_OFFSET_BITS | at);
+}
+
+// Smallest power of two that is at least n
+static uint32_t round_up(uint32_t n)
+{
+  uint32_t size = 1;
+  while (size < n)
+    size <<= 1;
+  return size;
+}
+
+static uint32_t floor_log2(uint32_t n)
+{
+  uint32_t log = 0;
+  while (n >>= 1)
+    log++;
+  return log;
+}
+
+void heap_init(heap *h)
+{
+  h->chunks = no_chunks;
+  h->chunk_mask = 0;
+  h->chunk_count = 1;
+  h->current = 0;
+  memset(h->free, 0, sizeof(h->free));
+  h->free_classes = 0;
+  h->spare = NULL;
+  h->spare_count = 0;
+  h->spare_size = 0;
+  h->marking = NULL;
+  h->marking_size = 0;
+  h->pending = 0;
+  h->incomplete = false;
+  h->started_ns = 0;
+  h->allocated = 0;
+  h->threshold = HEAP_GC_WORDS;
+  memset(&h->stats, 0, sizeof(h->stats));
+}
+
+void heap_destroy(heap *h)
+{
+  for (uint32_t i = 1; i < h->chunk_count; i++)
+  {
+    if (h->chunks[i].bits)
+    {
+      free(h->chunks[i].words);
+      free(h->chunks[i].bits);
+    }
+  }
+  if (h->chunks != no_chunks)
+    free(h->chunks);
+  free(h->spare);
+  free(h->marking);
+  heap_init(h);
+}
+
+// Adds a zeroed chunk of size words, a power of two of at least 1024, and
+// returns its index, or 0 when it cannot be added
+static uint32_t add_chunk(heap *h, uint32_t size)
+{
+  heap_chunk c = {NULL, size - 1, 0, NULL};
+  c.words = (word_t *)calloc(size, sizeof(word_t));
+  c.bits = (uint64_t *)calloc(3 * (size_t)bitmap_words(&c), sizeof(uint64_t));
+  if (!c.words || !c.bits)
+  {
+    free(c.words);
+    free(c.bits);
+    return 0;
+  }
+
+  uint32_t index;
+  if (h->spare_count > 0)
+    index = h->spare[--h->spare_count];
+  // the index has to fit in the upper bits of a reference
+  else if (h->chunk_count > UINT32_MAX >> HEAP_OFFSET_BITS)
+    index = 0;
+  else if (h->chunk_count <= h->chunk_mask)
+    index = h->chunk_count++;
+  else
+  {
+    uint32_t entries = (h->chunk_mask + 1) * 2;
+    if (entries < 16)
+      entries = 16;
+    heap_chunk *chunks = (heap_chunk *)malloc(sizeof(heap_chunk) * entries);
+    if (chunks)
+    {
+      memcpy(chunks, h->chunks, sizeof(heap_chunk) * h->chunk_count);
+      for (uint32_t i = h->chunk_count; i < entries; i++)
+        chunks[i] = no_chunks[0];
+      if (h->chunks != no_chunks)
+        free(h->chunks);
+      h->chunks = chunks;
+      h->chunk_mask = entries - 1;
+    }
+    index = chunks ? h->chunk_count++ : 0;
+  }
+  if (index == 0)
+  {
+    free(c.words);
+    free(c.bits);
+    return 0;
+  }
+
+  h->chunks[index] = c;
+  h->stats.heap_bytes += sizeof(word_t) * (size_t)size;
+  return index;
+}
+
+// Frees chunk i and keeps its index for the next chunk to be added
+static void release_chunk(heap *h, uint32_t i)
+{
+  heap_chunk *c = &h->chunks[i];
+  h->stats.heap_bytes -= sizeof(word_t) * ((size_t)c->mask + 1);
+  free(c->words);
+  free(c->bits);
+  *c = no_chunks[0];
+
+  if (h->spare_count == h->spare_size)
+  {
+    uint32_t size = h->spare_size ? h->spare_size * 2 : 16;
+    uint32_t *spare = (uint32_t *)realloc(h->spare, sizeof(uint32_t) * size);
+    // without room the index is simply never used again
+    if (!spare)
+      return;
+    h->spare = spare;
+    h->spare_size = size;
+  }
+  h->spare[h->spare_count++] = i;
+}
+
+// Makes the size words at offset at of chunk ci, whose start bit is set, a
+// free block
+static void add_free(heap *h, uint32_t ci, uint32_t at, uint32_t size)
+{
+  word_t *block = &h->chunks[ci].words[at];
+  block[0] = 0;
+  if (size < 3)
+    return;
+  uint32_t cls = floor_log2(size);
+  block[1] = (word_t)size;
+  block[2] = h->free[cls];
+  h->free[cls] = make_ref(ci, at);
+  h->free_classes |= 1u << cls;
+}
+
+// The chunk of the free block ref names, with its offset in *at and size
+// in *size, or NULL when ref names none
+static heap_chunk *free_block(heap *h, word_t ref, uint32_t *at, uint32_t *size)
+{
+  uint32_t ci = (uint32_t)ref >> HEAP_OFFSET_BITS;
+  if (ci >= h->chunk_count)
+    return NULL;
+  heap_chunk *c = &h->chunks[ci];
+  *at = (uint32_t)ref & HEAP_OFFSET_MASK;
+  if (!c->bits || c->mask >= HEAP_CHUNK_WORDS || *at + 3 > c->end ||
+      !test_bit(bitmap(c, STARTS), *at) || test_bit(bitmap(c, LIVE), *at))
+    return NULL;
+  *size = (uint32_t)c->words[*at + 1];
+  if (*size < 3 || *size > c->end - *at)
+    return NULL;
+  return c;
+}
+
+// Places an array of count elements in a free block of a class that
+// certainly fits its words, splitting off what is left. Returns 0 when
+// there is none.
+static word_t take_free(heap *h, uint32_t words, word_t count)
+{
+  uint32_t cls = floor_log2(words);
+  if (words > 1u << cls)
+    cls++;
+  uint32_t classes = h->free_classes >> cls;
+  if (classes == 0)
+    return 0;
+  while (!(classes & 1))
+  {
+    classes >>= 1;
+    cls++;
+  }
+
+  word_t ref = h->free[cls];
+  uint32_t ci = (uint32_t)ref >> HEAP_OFFSET_BITS;
+  uint32_t at;
+  uint32_t size = 0;
+  heap_chunk *c = free_block(h, ref, &at, &size);
+  // a broken list is dropped, the next collection rebuilds it
+  h->free[cls] = c && size >= words ? c->words[at + 2] : 0;
+  if (h->free[cls] == 0)
+    h->free_classes &= ~(1u << cls);
+  if (!c || size < words)
+    return 0;
+
+  if (size > words)
+  {
+    set_bit(bitmap(c, STARTS), at + words);
+    add_free(h, ci, at + words, size - words);
+  }
+  memset(&c->words[at], 0, sizeof(word_t) * words);
+  c->words[at] = count;
+  set_bit(bitmap(c, LIVE), at);
+  return ref;
+}
+
+// Places an array of count elements at the end of the current chunk,
+// starting a new one when it does not fit
+static word_t bump(heap *h, uint32_t words, word_t count)
+{
+  heap_chunk *c = &h->chunks[h->current];
+  if (h->current == 0 || c->end + words > c->mask + 1)
+  {
+    // a machine with a few small arrays keeps a small heap
+    uint32_t size = HEAP_FIRST_CHUNK;
+    if (h->current != 0)
+      size = (c->mask + 1) * 2;
+    if (size > HEAP_CHUNK_WORDS)
+      size = HEAP_CHUNK_WORDS;
+    if (size < words)
+      size = round_up(words);
+
+    uint32_t old = h->current;
+    uint32_t chunk = add_chunk(h, size);
+    if (chunk == 0)
+      return 0;
+
+    // what the old chunk has left is free
+    c = &h->chunks[old];
+    if (old != 0 && c->end <= c->mask)
+    {
+      set_bit(bitmap(c, STARTS), c->end);
+      add_free(h, old, c->end, c->mask + 1 - c->end);
+      c->end = c->mask + 1;
+    }
+    h->current = chunk;
+    c = &h->chunks[chunk];
+  }
+
+  uint32_t at = c->end;
+  c->end += words;
+  c->words[at] = count;
+  set_bit(bitmap(c, STARTS), at);
+  set_bit(bitmap(c, LIVE), at);
+  return make_ref(h->current, at);
+}
+
+word_t heap_new(heap *h, word_t count)
+{
+  if (count < 0 || count > HEAP_MAX_LENGTH)
+    return 0;
+  uint32_t words = (uint32_t)count + 1;
+
+  word_t ref;
+  if (words > HEAP_SMALL_WORDS)
+  {
+    uint32_t chunk = add_chunk(h, round_up(words));
+    ref = 0;
+    if (chunk != 0)
+    {
+      heap_chunk *c = &h->chunks[chunk];
+      c->end = words;
+      c->words[0] = count;
+      set_bit(bitmap(c, STARTS), 0);
+      set_bit(bitmap(c, LIVE), 0);
+      ref = make_ref(chunk, 0);
+    }
+  }
+  else
+  {
+    ref = take_free(h, words, count);
+    if (ref == 0)
+      ref = bump(h, words, count);
+  }
+
+  if (ref != 0)
+  {
+    h->allocated += words;
+    h->stats.live_bytes += sizeof(word_t) * words;
+  }
+  return ref;
+}
+
+word_t *heap_slot(heap *h, word_t ref, word_t index)
+{
+  const heap_chunk *c = &h->chunks[((uint32_t)ref >> HEAP_OFFSET_BITS) & h->chunk_mask];
+  uint32_t at = (uint32_t)ref & HEAP_OFFSET_MASK;
+  if ((uint32_t)index >= (uint32_t)c->words[at & c->mask])
+    return NULL;
+  return &c->words[(at + 1 + (uint32_t)index) & c->mask];
+}
+
+// The chunk of the live array ref names, with its offset in *at, or NULL
+// when ref names none
+static heap_chunk *live_array(heap *h, word_t ref, uint32_t *at)
+{
+  uint32_t ci = (uint32_t)ref >> HEAP_OFFSET_BITS;
+  if (ci >= h->chunk_count)
+    return NULL;
+  heap_chunk *c = &h->chunks[ci];
+  *at = (uint32_t)ref & HEAP_OFFSET_MASK;
+  if (!c->bits || *at >= c->end || *at >= 64 * bitmap_words(c) ||
+      !test_bit(bitmap(c, LIVE), *at))
+    return NULL;
+  return c;
+}
+
+bool heap_is_freed(heap *h, word_t ref)
+{
+  uint32_t at;
+  return live_array(h, ref, &at) == NULL;
+}
+
+// Marks the array word names, if any and not yet marked, and queues it so
+// its elements get scanned. Returns false when the worklist cannot grow.
+static bool mark(heap *h, word_t word)
+{
+  uint32_t at;
+  heap_chunk *c = live_array(h, word, &at);
+  if (!c || test_bit(bitmap(c, MARKS), at))
+    return true;
+  set_bit(bitmap(c, MARKS), at);
+
+  if (h->pending == h->marking_size)
+  {
+    uint32_t size = h->marking_size ? h->marking_size * 2 : 256;
+    word_t *marking = (word_t *)realloc(h->marking, sizeof(word_t) * size);
+    if (!marking)
+      return false;
+    h->marking = marking;
+    h->marking_size = size;
+  }
+  h->marking[h->pending++] = word;
+  return true;
+}
+
+// Where sweep_chunk() is in its chunk
+typedef struct SWEEP {
+  uint32_t chunk;
+  uint32_t run;  // start of the free blocks being merged, NONE between runs
+  bool release;  // whether the chunk is given back afterwards
+  uint64_t freed;
+} sweep_state;
+
+// Sweeps the block from block up to next: an unmarked array is freed, and
+// free blocks are merged into the run they are part of, which is put on a
+// free list once a live block ends it
+static void sweep_block(heap *h, sweep_state *s, uint32_t block, uint32_t next)
+{
+  heap_chunk *c = &h->chunks[s->chunk];
+  uint64_t *live = bitmap(c, LIVE);
+  if (test_bit(live, block) && test_bit(bitmap(c, MARKS), block))
+  {
+    if (s->run != NONE && !s->release)
+      add_free(h, s->chunk, s->run, block - s->run);
+    s->run = NONE;
+    return;
+  }
+
+  if (test_bit(live, block))
+  {
+    clear_bit(live, block);
+    c->words[block] = 0;
+    s->freed += next - block;
+  }
+  if (s->run == NONE)
+    s->run = block;
+  else
+    clear_bit(bitmap(c, STARTS), block);
+}
+
+// Sweeps chunk ci, giving it back when no live array is left in it, and
+// returns the words freed
+static uint64_t sweep_chunk(heap *h, uint32_t ci)
+{
+  heap_chunk *c = &h->chunks[ci];
+  uint32_t n = bitmap_words(c);
+  const uint64_t *starts = bitmap(c, STARTS);
+  const uint64_t *live = bitmap(c, LIVE);
+  const uint64_t *marks = bitmap(c, MARKS);
+
+  sweep_state s = {ci, NONE, ci != h->current, 0};
+  for (uint32_t i = 0; i < n && s.release; i++)
+    s.release = (live[i] & marks[i]) == 0;
+  if (c->end == 0)
+  {
+    if (s.release)
+      release_chunk(h, ci);
+    return 0;
+  }
+
+  // every chunk in use has a block at 0, and its blocks end at end
+  uint32_t block = 0;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    uint64_t bits = starts[i];
+    if (i == 0)
+      bits &= ~(uint64_t)1;
+    while (bits)
+    {
+      uint32_t next = i * 64 + (uint32_t)__builtin_ctzll(bits);
+      bits &= bits - 1;
+      sweep_block(h, &s, block, next);
+      block = next;
+    }
+  }
+  sweep_block(h, &s, block, c->end);
+
+  if (s.release)
+    release_chunk(h, ci);
+  else if (s.run != NONE && ci == h->current)
+  {
+    // a free run at the end of the current chunk goes back to bumping
+    clear_bit(bitmap(c, STARTS), s.run);
+    memset(&c->words[s.run], 0, sizeof(word_t) * (c->end - s.run));
+    c->end = s.run;
+  }
+  else if (s.run != NONE)
+    add_free(h, ci, s.run, c->end - s.run);
+  return s.freed;
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void heap_start_collection(heap *h)
+{
+  h->started_ns = now_ns();
+  for (uint32_t i = 1; i < h->chunk_count; i++)
+  {
+    heap_chunk *c = &h->chunks[i];
+    if (c->bits)
+      memset(bitmap(c, MARKS), 0, sizeof(uint64_t) * bitmap_words(c));
+  }
+  h->pending = 0;
+  h->incomplete = false;
+}
+
+void heap_mark_roots(heap *h, const word_t *roots, uint32_t count)
+{
+  for (uint32_t i = 0; i < count && !h->incomplete; i++)
+    h->incomplete = !mark(h, roots[i]);
+}
+
+void heap_collect(heap *h)
+{
+  while (h->pending > 0 && !h->incomplete)
+  {
+    word_t ref = h->marking[--h->pending];
+    const heap_chunk *c = &h->chunks[(uint32_t)ref >> HEAP_OFFSET_BITS];
+    uint32_t at = (uint32_t)ref & HEAP_OFFSET_MASK;
+    uint32_t length = (uint32_t)c->words[at];
+    if (length > c->end - at - 1)
+      length = c->end - at - 1;
+    for (uint32_t i = 1; i <= length && !h->incomplete; i++)
+      h->incomplete = !mark(h, c->words[at + i]);
+  }
+
+  // without every reachable array marked, nothing is known to be dead
+  uint64_t freed = 0;
+  if (!h->incomplete)
+  {
+    memset(h->free, 0, sizeof(h->free));
+    h->free_classes = 0;
+    for (uint32_t i = 1; i < h->chunk_count; i++)
+    {
+      if (h->chunks[i].bits)
+        freed += sweep_chunk(h, i);
+    }
+  }
+
+  uint64_t pause = now_ns() - h->started_ns;
+  gc_stats *st = &h->stats;
+  st->collections++;
+  st->last_pause_ns = pause;
+  st->total_pause_ns += pause;
+  if (pause > st->max_pause_ns)
+    st->max_pause_ns = pause;
+  st->last_reclaimed_bytes = sizeof(word_t) * freed;
+  st->total_reclaimed_bytes += sizeof(word_t) * freed;
+  st->live_bytes -= sizeof(word_t) * freed;
+
+  h->allocated = 0;
+  h->threshold = st->live_bytes / sizeof(word_t);
+  if (h->threshold < HEAP_GC_WORDS)
+    h->threshold = HEAP_GC_WORDS;
+}
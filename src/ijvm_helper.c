@@ -1,75 +1,129 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "ijvm_helper.h"
+#include "decode.h"
+#include "vstack.h"
+#include "io.h"
+#include "heap.h"
 #include "util.h"
 
-bool read_magic_number(ijvm *m, FILE *fp)
+// The stdio loader, used when the binary cannot be mmap'd (see loader.h)
+
+bool read_magic_number(ijvm_program *p, FILE *fp)
 {
     uint8_t buffer[4];
-    fread(&buffer, sizeof(uint8_t), 4, fp);
-    m->magic_num = read_uint32(buffer);
-    return (m->magic_num == MAGIC_NUMBER);
+    if (fread(&buffer, sizeof(uint8_t), 4, fp) != 4)
+        return false;
+    p->magic_num = read_uint32(buffer);
+    return (p->magic_num == MAGIC_NUMBER);
 }
 
-bool read_constant_pool(ijvm *m, FILE *fp)
+bool read_constant_pool(ijvm_program *p, FILE *fp)
 {
     uint8_t buffer[4];
-    fread(&buffer, sizeof(uint8_t), 4, fp);
-    m->constant_origin = read_uint32(buffer);
-
-    fread(&buffer, sizeof(uint8_t), 4, fp);
-    m->constant_size = read_uint32(buffer);
-
-    m->constant_data = (word_t *)malloc(sizeof(word_t) * m->constant_size / 4);
-    for (uint32_t i = 0; i < m->constant_size / 4; i++)
-    {
-        fread(&buffer, sizeof(uint8_t), 4, fp);
-        m->constant_data[i] = read_uint32(buffer);
-    }
+    if (fread(&buffer, sizeof(uint8_t), 4, fp) != 4)
+        return false;
+    p->constant_origin = read_uint32(buffer);
+
+    if (fread(&buffer, sizeof(uint8_t), 4, fp) != 4)
+        return false;
+    p->constant_size = read_uint32(buffer);
+
+    // read the raw pool into place and swap it there
+    p->constant_data = (word_t *)malloc(sizeof(word_t) * (p->constant_size / 4 + 1));
+    if (!p->constant_data ||
+        fread(p->constant_data, sizeof(uint8_t), p->constant_size, fp) != p->constant_size)
+        return false;
+    read_uint32_array((uint32_t *)p->constant_data, (const uint8_t *)p->constant_data,
+                      p->constant_size / 4);
     return true;
 }
 
-bool read_text_section(ijvm *m, FILE *fp)
+bool read_text_section(ijvm_program *p, FILE *fp)
 {
     uint8_t buffer[4];
-    fread(&buffer, sizeof(uint8_t), 4, fp);
-    m->text_origin = read_uint32(buffer);
-
-    fread(&buffer, sizeof(uint8_t), 4, fp);
-    m->text_size = read_uint32(buffer);
+    if (fread(&buffer, sizeof(uint8_t), 4, fp) != 4)
+        return false;
+    p->text_origin = read_uint32(buffer);
+
+    if (fread(&buffer, sizeof(uint8_t), 4, fp) != 4)
+        return false;
+    p->text_size = read_uint32(buffer);
+
+    p->text_data = (uint8_t *)malloc(sizeof(uint8_t) * (p->text_size ? p->text_size : 1));
+    if (!p->text_data)
+        return false;
+    p->text_owned = true;
+    return fread(p->text_data, sizeof(uint8_t), p->text_size, fp) == p->text_size;
+}
 
-    m->text_data = (uint8_t *)malloc(sizeof(uint8_t) * m->text_size);
-    for (uint32_t i = 0; i < m->text_size; i++)
-    {
-        fread(&buffer[0], sizeof(uint8_t), 1, fp);
-        m->text_data[i] = buffer[0];
-    }
-    return true;
+// main's locals sit at the bottom of the stack. Its operands start above
+// a guard word, as a callee's do, so that the cached top of stack of an
+// empty operand stack is never one of its locals.
+static uint32_t main_locals_end(ijvm *m)
+{
+    return m->methods[0].locals > 256 ? m->methods[0].locals : 256;
 }
 
-void initialize_stack(ijvm *m)
+void initialize_stack(ijvm *m, bool use_vstack)
 {
+    method *main_method = &m->methods[0];
     m->st = (stack *)malloc(sizeof(stack));
-    m->st->index_top = 256;
-    m->st->size = 1024;
-    m->st->data = (word_t *)malloc(sizeof(word_t) * m->st->size);
+    m->st->index_top = main_locals_end(m) + 1;
+    m->st->mapped = false;
+    if (!use_vstack || !vstack_create(m->st))
+    {
+        m->st->size = 1024;
+        while (m->st->size < m->st->index_top + main_method->reserve)
+            m->st->size *= 2;
+        m->st->data = (word_t *)calloc(m->st->size, sizeof(word_t));
+    }
     m->lv = 0;
+
+    m->frames = (call_stack *)malloc(sizeof(call_stack));
+    m->frames->depth = 0;
+    m->frames->size = 64;
+    m->frames->data = (frame *)malloc(sizeof(frame) * m->frames->size);
 }
 
-void push(ijvm *m, word_t value)
+void reserve_stack(ijvm *m, uint32_t count)
 {
-  if (m->st->index_top >= m->st->size)
+  if (m->st->index_top + count > m->st->size)
   {
-    m->st->size *= 2;
+    if (m->st->mapped)
+    {
+      vstack_overflow(m);
+      return;
+    }
+    uint32_t old_size = m->st->size;
+    while (m->st->index_top + count > m->st->size)
+      m->st->size *= 2;
     m->st->data = (word_t *)realloc(m->st->data, sizeof(word_t)*m->st->size);
+    memset(m->st->data + old_size, 0, sizeof(word_t) * (m->st->size - old_size));
   }
+}
 
+void push(ijvm *m, word_t value)
+{
   m->st->data[m->st->index_top] = value;
   m->st->index_top++;
 }
 
+void push_frame(ijvm *m, frame f)
+{
+  if (m->frames->depth >= m->frames->size)
+  {
+    m->frames->size *= 2;
+    m->frames->data = (frame *)realloc(m->frames->data, sizeof(frame) * m->frames->size);
+  }
+
+  m->frames->data[m->frames->depth] = f;
+  m->frames->depth++;
+}
+
 word_t pop(ijvm *m)
 {
   word_t value = tos(m);
@@ -77,17 +131,63 @@ word_t pop(ijvm *m)
   return value;
 }
 
-int16_t get_short_arg(ijvm *m)
+// The decoded form of the instruction at the program counter
+static insn *current(ijvm *m)
+{
+  return &m->code[m->pc];
+}
+
+void get_frame_bounds(ijvm *m, frame_bounds *b)
 {
-  uint8_t short_bytes[] = {get_text(m)[m->pc + 1], get_text(m)[m->pc + 2]};
-  return read_int16(short_bytes);
+    if (m->frames->depth == 0)
+    {
+        b->locals_end = main_locals_end(m);
+    }
+    else
+    {
+        const frame *f = &m->frames->data[m->frames->depth - 1];
+        const uint8_t *header = m->text_data + f->method;
+        b->locals_end = f->height + read_uint16(header) + read_uint16(header + 2);
+    }
+    b->base = b->locals_end + 1; // the guard word
+}
+
+bool check_insn(ijvm *m, const frame_bounds *b)
+{
+    const insn *in = current(m);
+    if (in->op == D_SKIP || (uint32_t)m->pc + in->len > m->text_size)
+        return false;
+
+    int32_t pops;
+    int32_t pushes;
+    insn_stack_effect(in, &pops, &pushes);
+    switch (in->op)
+    {
+    case D_ILOAD:
+    case D_ISTORE:
+    case D_IINC:
+        if ((uint32_t)m->lv + (uint32_t)in->a >= b->locals_end)
+            return false;
+        break;
+    case D_LDC_W:
+        if ((uint32_t)in->a >= m->constant_size / 4)
+            return false;
+        break;
+    case D_INVOKEVIRTUAL:
+        if (in->xop != D_INVOKEVIRTUAL_QUICK)
+            return false;
+        pops = m->methods[in->c].args;
+        break;
+    default:
+        break;
+    }
+    return m->st->index_top >= b->base + (uint32_t)pops;
 }
 
 void perform_bipush(ijvm *m)
 {
-    m->pc++;
-    push(m, (int8_t)get_instruction(m));
-    m->pc++;
+    push(m, current(m)->a);
+    m->pc += current(m)->len;
 }
 
 void perform_dup(ijvm *m)
@@ -142,9 +242,104 @@ void perform_swap(ijvm *m)
     m->pc++;
 }
 
+word_t new_array(ijvm *m, word_t count)
+{
+    if (HEAP_COLLECTION_DUE(&m->heap))
+        collect_garbage(m);
+    word_t ref = heap_new(&m->heap, count);
+    if (ref == 0 && count >= 0 && count <= HEAP_MAX_LENGTH)
+    {
+        collect_garbage(m);
+        ref = heap_new(&m->heap, count);
+    }
+    return ref;
+}
+
+// The roots are the locals and operands of every frame, the guard words
+// between them left out. Stack memory starts zeroed, so locals a program
+// has not written yet read as 0, or, without fill_locals, as whatever an
+// earlier frame left there.
+void collect_garbage(ijvm *m)
+{
+    heap *h = &m->heap;
+    const word_t *data = m->st->data;
+    heap_start_collection(h);
+
+    uint32_t base = main_locals_end(m);
+    heap_mark_roots(h, data, base);
+    base++;
+    for (uint32_t i = 0; i < m->frames->depth; i++)
+    {
+        const frame *f = &m->frames->data[i];
+        const uint8_t *header = m->text_data + f->method;
+        uint32_t locals_end = f->height + read_uint16(header) + read_uint16(header + 2);
+        heap_mark_roots(h, data + base, f->height - base);
+        heap_mark_roots(h, data + f->height, locals_end - f->height);
+        base = locals_end + 1;
+    }
+    heap_mark_roots(h, data + base, m->st->index_top - base);
+
+    heap_collect(h);
+}
+
+// The array instructions stop the machine at themselves, with the stack
+// untouched, when the array cannot be made or the element does not exist
+void perform_newarray(ijvm *m)
+{
+    word_t ref = new_array(m, tos(m));
+    if (ref == 0)
+    {
+        m->is_finished = true;
+        return;
+    }
+    pop(m);
+    push(m, ref);
+    m->pc++;
+}
+
+void perform_iaload(ijvm *m)
+{
+    word_t *data = m->st->data;
+    uint32_t top = m->st->index_top;
+    word_t *slot = heap_slot(&m->heap, data[top - 1], data[top - 2]);
+    if (!slot)
+    {
+        m->is_finished = true;
+        return;
+    }
+    pop(m);
+    pop(m);
+    push(m, *slot);
+    m->pc++;
+}
+
+void perform_iastore(ijvm *m)
+{
+    word_t *data = m->st->data;
+    uint32_t top = m->st->index_top;
+    word_t *slot = heap_slot(&m->heap, data[top - 1], data[top - 2]);
+    if (!slot)
+    {
+        m->is_finished = true;
+        return;
+    }
+    *slot = data[top - 3];
+    pop(m);
+    pop(m);
+    pop(m);
+    m->pc++;
+}
+
+void perform_gc(ijvm *m)
+{
+    collect_garbage(m);
+    m->pc++;
+}
+
 void perform_err(ijvm *m)
 {
-    fprintf(m->out, "ERROR\n");
+    for (const char *c = "ERROR\n"; *c; c++)
+        io_put(m, (uint8_t)*c);
     m->is_finished = true;
 }
 
@@ -156,7 +351,7 @@ void perform_halt(ijvm *m)
 
 void perform_in(ijvm *m)
 {
-    int c = fgetc(m->in);
+    int c = io_get(m);
     if (c == EOF)
         push(m, 0);
     else
@@ -166,122 +361,121 @@ void perform_in(ijvm *m)
 
 void perform_out(ijvm *m)
 {
-    fprintf(m->out, "%c", pop(m));
+    io_put(m, (uint8_t)pop(m));
     m->pc++;
 }
 
 void perform_goto(ijvm *m)
 {
-    m->pc += get_short_arg(m);
+    m->pc = current(m)->a;
 }
 
 void perform_ifeq(ijvm *m)
 {
+    insn *i = current(m);
     if (pop(m) == 0)
-        m->pc += get_short_arg(m);
+        m->pc = i->a;
     else
-        m->pc += 3;
+        m->pc += i->len;
 }
 
 void perform_iflt(ijvm *m)
 {
+    insn *i = current(m);
     if (pop(m) < 0)
-        m->pc += get_short_arg(m);
+        m->pc = i->a;
     else
-        m->pc += 3;
+        m->pc += i->len;
 }
 
 void perform_if_icmpeq(ijvm *m)
 {
+    insn *i = current(m);
     if (pop(m) == pop(m))
-        m->pc += get_short_arg(m);
+        m->pc = i->a;
     else
-        m->pc += 3;
+        m->pc += i->len;
 }
 
 void perform_ldc_w(ijvm *m)
 {
-    push(m, get_constant(m, get_short_arg(m)));
-    m->pc += 3;
+    insn *i = current(m);
+    if (i->xop == D_LDC_W_QUICK)
+        push(m, i->b);
+    else
+        push(m, get_constant(m, i->a));
+    m->pc += i->len;
 }
 
 void perform_iload(ijvm *m)
 {
-    m->pc++;
-    push(m, get_local_variable(m, get_instruction(m)));
-    m->pc++;
+    push(m, get_local_variable(m, current(m)->a));
+    m->pc += current(m)->len;
 }
 
 void perform_istore(ijvm *m)
 {
-    m->pc++;
-    m->st->data[m->lv + get_instruction(m)] = pop(m);
-    m->pc++;
+    insn *i = current(m);
+    m->st->data[m->lv + i->a] = pop(m);
+    m->pc += i->len;
 }
 
 void perform_iinc(ijvm *m)
 {
-    m->pc++;
-    byte_t index = get_instruction(m);
-    m->pc++;
-    m->st->data[m->lv + index] += (int8_t)get_instruction(m);
-    m->pc++;
-}
-
-void perform_wide(ijvm *m)
-{
-    m->pc++;
-    uint16_t index = get_short_arg(m);
-    switch (get_instruction(m))
-    {
-    case OP_ILOAD:
-        push(m, get_local_variable(m, index));
-        m->pc += 3;
-        break;
-    case OP_ISTORE:
-        m->st->data[m->lv + index] = pop(m);
-        m->pc += 3;
-        break;
-    case OP_IINC:
-        m->pc += 3;
-        m->st->data[m->lv + index] += (int8_t)get_instruction(m);
-        m->pc++;
-        break;
-    }
+    insn *i = current(m);
+    m->st->data[m->lv + i->a] += i->b;
+    m->pc += i->len;
 }
 
 void perform_invokevirtual(ijvm *m)
 {
-    word_t old_pc = m->pc;
-    word_t old_lv = m->lv;
+    insn *call = current(m);
+    frame f = {m->pc + call->len, m->lv, 0, 0};
 
-    m->pc = get_constant(m, get_short_arg(m));
+    // every call to an existing method was quickened at load time
+    if (call->xop != D_INVOKEVIRTUAL_QUICK)
+    {
+        m->is_finished = true;
+        return;
+    }
 
-    word_t arg_count = read_uint16(get_text(m) + m->pc);
-    m->pc += 2;
-    word_t local_var_count = read_uint16(get_text(m) + m->pc);
-    m->pc += 2;
+    method *callee = &m->methods[call->c];
+    reserve_stack(m, callee->reserve);
 
-    for (size_t i = 0; i < local_var_count; i++)
+    word_t *locals = m->st->data + m->st->index_top;
+    if (m->fill_locals)
     {
-        push(m, -69);
+        for (uint32_t i = 0; i < callee->locals; i++)
+            locals[i] = -69;
     }
+    m->st->index_top += callee->locals;
 
-    m->lv = m->st->index_top - arg_count - local_var_count;
-    m->st->data[m->lv] = m->st->index_top;
+    f.method = callee->entry - 4;
+    f.height = m->st->index_top - callee->locals - callee->args;
+    push_frame(m, f);
+    m->lv = (word_t)f.height;
+    m->pc = callee->entry;
 
-    push(m, old_pc);
-    push(m, old_lv);
+    // The operand stack of the callee starts with a guard word, so that the
+    // top of an empty operand stack is never one of its locals
+    m->st->data[m->st->index_top++] = 0;
 }
 
+// IRETURN outside of any method ends the machine
 void perform_ireturn(ijvm *m)
 {
-    word_t return_value = pop(m);
+    if (m->frames->depth == 0)
+    {
+        m->is_finished = true;
+        return;
+    }
 
-    m->st->index_top = m->lv;
+    frame *f = &m->frames->data[--m->frames->depth];
+    word_t return_value = pop(m);
 
-    m->pc = m->st->data[m->st->data[m->lv]] + 3;
-    m->lv = m->st->data[m->st->data[m->lv] + 1];
+    m->st->index_top = f->height;
+    m->pc = f->return_pc;
+    m->lv = f->lv;
 
     push(m, return_value);
 }
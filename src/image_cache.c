@@ -0,0 +1,257 @@
+// mmap and fstat are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image_cache.h"
+#include "program.h"
+#include "decode.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define HAVE_MMAP 0
+#endif
+
+bool image_cache_enabled(void)
+{
+  char *use_cache = getenv("IJVM_IMAGE_CACHE");
+  return use_cache && *use_cache && *use_cache != '0';
+}
+
+#if HAVE_MMAP
+
+static const char IMAGE_MAGIC[8] = {'I', 'J', 'V', 'M', 'I', 'M', 'G', '\0'};
+
+// Written in host order: a file from a machine of the other endianness or
+// with other struct sizes fails the byte_order or size checks and is
+// rebuilt
+typedef struct IMAGE_HEADER {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;     // 0x01020304
+  uint32_t insn_size;      // sizeof(insn)
+  uint32_t method_size;    // sizeof(method)
+  uint64_t source_hash;    // program_hash() of the binary
+  uint32_t constant_size;
+  uint32_t text_size;
+  uint32_t method_count;
+  uint32_t verified;       // the program passed the verifier
+  uint64_t code_offset;    // text_size + CODE_PADDING insns
+  uint64_t methods_offset; // method_count methods
+  uint64_t file_size;
+  int64_t mtime;           // seconds; the file is given this mtime when written
+} image_header;
+
+// Sections start on a 16 byte boundary of the file
+static uint64_t align(uint64_t offset)
+{
+  return (offset + 15) & ~(uint64_t)15;
+}
+
+static void fill_header(image_header *h, const ijvm_program *p, uint32_t method_count,
+                        bool verified)
+{
+  memset(h, 0, sizeof(image_header));
+  memcpy(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  h->version = IMAGE_VERSION;
+  h->byte_order = 0x01020304;
+  h->insn_size = (uint32_t)sizeof(insn);
+  h->method_size = (uint32_t)sizeof(method);
+  h->source_hash = program_hash(p);
+  h->constant_size = p->constant_size;
+  h->text_size = p->text_size;
+  h->method_count = method_count;
+  h->verified = verified;
+  h->code_offset = align(sizeof(image_header));
+  h->methods_offset = align(h->code_offset + sizeof(insn) * ((uint64_t)p->text_size + CODE_PADDING));
+  h->file_size = h->methods_offset + sizeof(method) * (uint64_t)method_count;
+}
+
+// p->path + ".cache", or NULL
+static char *cache_path(const ijvm_program *p)
+{
+  if (!p->path)
+    return NULL;
+  size_t len = strlen(p->path) + sizeof(".cache");
+  char *path = (char *)malloc(len);
+  if (path)
+    snprintf(path, len, "%s.cache", p->path);
+  return path;
+}
+
+// The modification time of a stat result, in seconds and nanoseconds
+static void mtime_of(const struct stat *info, int64_t *sec, long *nsec)
+{
+#ifdef __APPLE__
+  *sec = info->st_mtimespec.tv_sec;
+  *nsec = info->st_mtimespec.tv_nsec;
+#else
+  *sec = info->st_mtim.tv_sec;
+  *nsec = info->st_mtim.tv_nsec;
+#endif
+}
+
+bool image_cache_load(ijvm_program *p)
+{
+  char *path = cache_path(p);
+  if (!path)
+    return false;
+  int fd = open(path, O_RDONLY | O_NOFOLLOW);
+  free(path);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+      (size_t)info.st_size >= sizeof(image_header))
+    base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return false;
+
+  // the header has to be exactly what storing p again would write, and the
+  // file must not have been written since it was stored. The body is not
+  // looked at: a file that passes is taken to be the one image_cache_store()
+  // wrote, which keeps loading down to one mmap.
+  const image_header *found = (const image_header *)base;
+  image_header expected;
+  uint32_t method_count = found->method_count;
+  bool verified = found->verified == 1;
+  fill_header(&expected, p, method_count, verified);
+  expected.mtime = found->mtime;
+  int64_t mtime;
+  long mtime_nsec;
+  mtime_of(&info, &mtime, &mtime_nsec);
+  if (memcmp(base, &expected, sizeof(image_header)) != 0 ||
+      (uint64_t)info.st_size != expected.file_size || method_count == 0 ||
+      mtime != expected.mtime)
+  {
+    munmap(base, (size_t)info.st_size);
+    return false;
+  }
+
+  // mapped read-only, which is fine as programs are never written once loaded
+  p->code = (insn *)(void *)((uint8_t *)base + expected.code_offset);
+  p->methods = (method *)(void *)((uint8_t *)base + expected.methods_offset);
+  p->method_count = method_count;
+  p->verified = verified;
+  p->image = base;
+  p->image_size = (size_t)info.st_size;
+  p->image_dev = (uint64_t)info.st_dev;
+  p->image_ino = (uint64_t)info.st_ino;
+  p->image_mtime = mtime;
+  p->image_mtime_nsec = mtime_nsec;
+  return true;
+}
+
+bool image_cache_changed(const ijvm_program *p)
+{
+  char *path = cache_path(p);
+  if (!path)
+    return false;
+  struct stat info;
+  bool found = stat(path, &info) == 0;
+  free(path);
+  // a file renamed over it leaves the mapped one alone
+  if (!found || (uint64_t)info.st_dev != p->image_dev || (uint64_t)info.st_ino != p->image_ino)
+    return false;
+  int64_t mtime;
+  long mtime_nsec;
+  mtime_of(&info, &mtime, &mtime_nsec);
+  return mtime != p->image_mtime || mtime_nsec != p->image_mtime_nsec;
+}
+
+void image_cache_unload(ijvm_program *p)
+{
+  if (p->image)
+    munmap(p->image, p->image_size);
+  p->image = NULL;
+  p->image_size = 0;
+}
+
+void image_cache_store(const ijvm_program *p)
+{
+  char *path = cache_path(p);
+  if (!path)
+    return;
+  size_t len = strlen(path) + 32;
+  char *tmp_path = (char *)malloc(len);
+  if (!tmp_path)
+  {
+    free(path);
+    return;
+  }
+  // written under a name of its own and renamed into place, so concurrent
+  // loads never map a half written file; the counter keeps threads of one
+  // process storing the same program apart
+  static atomic_uint stores = 0;
+  snprintf(tmp_path, len, "%s.%ld.%u.tmp", path, (long)getpid(),
+           atomic_fetch_add_explicit(&stores, 1, memory_order_relaxed));
+
+  // The mtime is a whole, even number of seconds at least two seconds in
+  // the past, so that any later write, even on a file system that keeps
+  // mtimes in steps of two seconds, moves it
+  image_header h;
+  fill_header(&h, p, p->method_count, p->verified);
+  h.mtime = ((int64_t)time(NULL) - 2) & ~(int64_t)1;
+  static const uint8_t zeros[16] = {0};
+  size_t code_count = (size_t)p->text_size + CODE_PADDING;
+  uint64_t code_end = h.code_offset + sizeof(insn) * code_count;
+
+  FILE *f = fopen(tmp_path, "wb");
+  bool ok = f != NULL;
+  if (ok)
+  {
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+         fwrite(zeros, 1, (size_t)(h.code_offset - sizeof(h)), f) == h.code_offset - sizeof(h) &&
+         fwrite(p->code, sizeof(insn), code_count, f) == code_count;
+    ok = ok && fwrite(zeros, 1, (size_t)(h.methods_offset - code_end), f) ==
+                   h.methods_offset - code_end;
+    ok = ok && fwrite(p->methods, sizeof(method), p->method_count, f) == p->method_count;
+    ok = fclose(f) == 0 && ok;
+    struct timespec times[2] = {{(time_t)h.mtime, 0}, {(time_t)h.mtime, 0}};
+    ok = ok && utimensat(AT_FDCWD, tmp_path, times, 0) == 0;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok)
+      remove(tmp_path);
+  }
+
+  free(tmp_path);
+  free(path);
+}
+
+#else
+
+bool image_cache_load(ijvm_program *p)
+{
+  (void)p;
+  return false;
+}
+
+void image_cache_store(const ijvm_program *p)
+{
+  (void)p;
+}
+
+void image_cache_unload(ijvm_program *p)
+{
+  (void)p;
+}
+
+bool image_cache_changed(const ijvm_program *p)
+{
+  (void)p;
+  return false;
+}
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "interpreter.h"
+#include "ijvm_ext.h"
+#include "io.h"
+#include "heap.h"
+#include "ijvm_helper.h"
+#include "decode.h"
+#include "util.h"
+
+// Labels-as-values and `goto *` are GNU extensions; they are only used when
+// IJVM_COMPUTED_GOTO is set, so silence the pedantic warnings for this file.
+#if IJVM_COMPUTED_GOTO
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+// The hot machine state lives in locals while the loop runs, and the top
+// stack slot is cached in `cache` (its copy in data[top - 1] is stale).
+// SAVE() spills everything back to the ijvm struct before anything outside
+// the loop looks at the machine, LOAD() picks it up again afterwards (the
+// stack may have been reallocated). Fuel is kept in `fuel` and only written
+// back when the machine is metered. The loop relies on the stack never being
+// empty, which holds because the main frame starts above the bottom.
+#define SAVE() \
+  do { \
+    m->pc = (word_t)(ip - code); \
+    SPILL(); \
+  } while (0)
+#define SPILL() \
+  do { \
+    if (top > 0) \
+      data[top - 1] = cache; \
+    m->st->index_top = top; \
+    if (m->fuel != IJVM_FUEL_UNLIMITED) \
+      m->fuel = fuel; \
+  } while (0)
+#define LOAD() \
+  do { \
+    top = m->st->index_top; \
+    data = m->st->data; \
+    lv = m->lv; \
+    cache = top > 0 ? data[top - 1] : 0; \
+  } while (0)
+
+// A mapped stack needs no capacity check: pushing into its guard region
+// ends the machine (see vstack.h)
+#define PUSH(v) \
+  do { \
+    word_t pushed = (v); \
+    if (!MAPPED && top >= m->st->size) { \
+      SAVE(); \
+      reserve_stack(m, 1); \
+      LOAD(); \
+    } \
+    data[top - 1] = cache; \
+    top++; \
+    cache = pushed; \
+  } while (0)
+#define POP_INTO(x) \
+  do { \
+    (x) = cache; \
+    top--; \
+    cache = data[top - 1]; \
+  } while (0)
+#define DROP() \
+  do { \
+    top--; \
+    cache = data[top - 1]; \
+  } while (0)
+
+// NEXT(n) falls through to the entry n bytes further, which always exists
+// thanks to the D_END padding. JUMP(t) is used after branches, calls and
+// returns. DISPATCH() is defined per loop.
+#if IJVM_COMPUTED_GOTO
+#define TARGET(name) L_##name:
+#define DEFAULT_TARGET
+#else
+#define TARGET(name) case D_##name:
+#define DEFAULT_TARGET default:
+#endif
+
+#define NEXT(n) \
+  do { \
+    ip += (n); \
+    DISPATCH(); \
+  } while (0)
+
+// Points slot at element index of the array at ref like heap_slot(), or
+// stops the machine when there is no such element (see FAIL)
+#define ELEMENT(ref, index) \
+  do { \
+    chunk = &m->heap.chunks[((uint32_t)(ref) >> HEAP_OFFSET_BITS) & m->heap.chunk_mask]; \
+    at = (uint32_t)(ref) & HEAP_OFFSET_MASK; \
+    if ((uint32_t)(index) >= (uint32_t)chunk->words[at & chunk->mask]) \
+      FAIL(); \
+    slot = &chunk->words[(at + 1 + (uint32_t)(index)) & chunk->mask]; \
+  } while (0)
+
+// Stops the machine at ip for want of fuel
+#define OUT_OF_FUEL() \
+  do { \
+    SAVE(); \
+    m->out_of_fuel = m->is_finished = true; \
+    return; \
+  } while (0)
+
+// Dispatch tables: the plain unchecked loop runs every xop as itself, the
+// others run superinstructions as the first instruction they cover, so that
+// each instruction gets checked and counted on its own
+#if IJVM_COMPUTED_GOTO
+#define FUSED_LABEL(name, base) [D_##name] = &&L_##name,
+#define UNFUSED_LABEL(name, base) [D_##name] = &&L_##base,
+#else
+#define UNFUSED_OP(name, base) [D_##name] = D_##base,
+static const uint8_t unfused[D_COUNT] = {DECODED_OPS(UNFUSED_OP)};
+#endif
+
+#define RUN_LOOP run_threaded
+#define CHECKED 0
+#define COUNTED 0
+#define MAPPED 0
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
+
+#define RUN_LOOP run_threaded_mapped
+#define CHECKED 0
+#define COUNTED 0
+#define MAPPED 1
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
+
+#define RUN_LOOP run_threaded_checked
+#define CHECKED 1
+#define COUNTED 0
+#define MAPPED 0
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
+
+#define RUN_LOOP run_threaded_checked_mapped
+#define CHECKED 1
+#define COUNTED 0
+#define MAPPED 1
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
+
+#define RUN_LOOP run_threaded_limited
+#define CHECKED 0
+#define COUNTED 1
+#define MAPPED 0
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
+
+#define RUN_LOOP run_threaded_limited_mapped
+#define CHECKED 0
+#define COUNTED 1
+#define MAPPED 1
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
+
+#define RUN_LOOP run_threaded_checked_limited
+#define CHECKED 1
+#define COUNTED 1
+#define MAPPED 0
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
+
+#define RUN_LOOP run_threaded_checked_limited_mapped
+#define CHECKED 1
+#define COUNTED 1
+#define MAPPED 1
+#include "interpreter_loop.h"
+#undef RUN_LOOP
+#undef CHECKED
+#undef COUNTED
+#undef MAPPED
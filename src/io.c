@@ -0,0 +1,261 @@
+// fileno, fstat and ioctl are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "io.h"
+
+// Whether in is a pipe, terminal or socket, where input arrives in pieces
+static bool is_stream(FILE *in)
+{
+  if (!in)
+    return false;
+  int fd = fileno(in);
+  struct stat st;
+  return fd >= 0 && fstat(fd, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+// Bytes waiting on in's descriptor, which together with whatever the FILE
+// has buffered can be read without blocking. Where the system does not
+// tell, this is 0, and streams are refilled a byte at a time.
+static size_t pending(FILE *in)
+{
+#ifdef FIONREAD
+  int count = 0;
+  if (ioctl(fileno(in), FIONREAD, &count) == 0 && count > 0)
+    return (size_t)count;
+#else
+  (void)in;
+#endif
+  return 0;
+}
+
+// Whether OUT is kept for get_output() rather than passed on
+static bool collecting(ijvm *m)
+{
+  return !m->out && !m->io.out_write;
+}
+
+void io_init(ijvm *m, const ijvm_io *io)
+{
+  if (io)
+    m->io = *io;
+  else
+    m->io = (ijvm_io){0};
+
+  size_t size = OUT_BUFFER_SIZE;
+  char *env = getenv("IJVM_OUT_BUFFER");
+  if (env && *env)
+    size = (size_t)strtoull(env, NULL, 10);
+
+  m->out_buffer = NULL;
+  m->out_used = 0;
+  m->out_size = 0;
+  io_set_buffer(m, size);
+
+  m->in_buffer = NULL;
+  m->in_pos = 0;
+  m->in_end = 0;
+  m->in_block = NULL;
+  m->in_stream = is_stream(m->in);
+}
+
+// Gives what was read ahead but not used back to m->in: a file is seeked
+// back, a stream gets the bytes pushed back with ungetc(). The C library
+// only promises to take one byte back; whatever it does not take stays
+// buffered here for a resumed machine, in front of what it did take back.
+static void unread_input(ijvm *m)
+{
+  uint32_t unread = m->in_end - m->in_pos;
+  if (unread == 0 || !m->in || m->in_buffer != m->in_block)
+    return;
+  if (!m->in_stream)
+  {
+    if (fseek(m->in, -(long)unread, SEEK_CUR) == 0)
+      m->in_pos = m->in_end = 0;
+    return;
+  }
+  while (m->in_end > m->in_pos && ungetc(m->in_block[m->in_end - 1], m->in) != EOF)
+    m->in_end--;
+}
+
+void io_destroy(ijvm *m)
+{
+  io_flush(m);
+  free(m->out_buffer);
+  unread_input(m);
+  free(m->in_block);
+}
+
+void io_return(ijvm *m)
+{
+  io_flush(m);
+  if (m->is_finished)
+    unread_input(m);
+}
+
+// Makes room for at least size bytes of collected output, keeping what is
+// there.
+static bool grow_output(ijvm *m, size_t size)
+{
+  if (size > UINT32_MAX)
+    return false;
+  size_t grown = (size_t)m->out_size * 2;
+  if (grown < size)
+    grown = size;
+  if (grown > UINT32_MAX)
+    grown = UINT32_MAX;
+
+  uint8_t *buffer = (uint8_t *)realloc(m->out_buffer, grown);
+  if (!buffer)
+    return false;
+  m->out_buffer = buffer;
+  m->out_size = (uint32_t)grown;
+  return true;
+}
+
+bool io_set_buffer(ijvm *m, size_t size)
+{
+  if (collecting(m))
+    return size <= m->out_size || grow_output(m, size);
+
+  io_flush(m);
+  free(m->out_buffer);
+  m->out_buffer = NULL;
+  m->out_size = 0;
+  if (size == 0)
+    return true;
+
+  if (size > UINT32_MAX)
+    size = UINT32_MAX;
+  m->out_buffer = (uint8_t *)malloc(size);
+  if (!m->out_buffer)
+    return false;
+  m->out_size = (uint32_t)size;
+  return true;
+}
+
+static void write_out(ijvm *m, const uint8_t *buf, size_t len)
+{
+  if (m->out)
+    fwrite(buf, 1, len, m->out);
+  else
+    m->io.out_write(m->io.ctx, buf, len);
+}
+
+void io_put(ijvm *m, uint8_t c)
+{
+  if (m->out_used == m->out_size)
+  {
+    if (collecting(m))
+    {
+      // nowhere to put it
+      if (!grow_output(m, (size_t)m->out_size + 1))
+        return;
+    }
+    else
+    {
+      io_flush(m);
+      if (m->out_size == 0)
+      {
+        write_out(m, &c, 1);
+        return;
+      }
+    }
+  }
+  m->out_buffer[m->out_used++] = c;
+}
+
+void io_flush(ijvm *m)
+{
+  if (m->out_used == 0 || collecting(m))
+    return;
+  write_out(m, m->out_buffer, m->out_used);
+  m->out_used = 0;
+}
+
+const uint8_t *io_output(ijvm *m, size_t *len)
+{
+  if (!collecting(m))
+  {
+    *len = 0;
+    return NULL;
+  }
+  *len = m->out_used;
+  return m->out_buffer;
+}
+
+void io_clear_output(ijvm *m)
+{
+  if (collecting(m))
+    m->out_used = 0;
+}
+
+// Reads up to len bytes of input into buf, returning how many, 0 at the end.
+// A stream waits for a single byte only, and then takes no more than has
+// arrived on its descriptor: the FILE serves what it buffered before going
+// to the descriptor, so none of that waits either. Input that trickles in
+// is handed over as it comes.
+static size_t refill(ijvm *m, uint8_t *buf, size_t len)
+{
+  if (!m->in)
+    return m->io.in_read(m->io.ctx, buf, len);
+  if (!m->in_stream)
+    return fread(buf, 1, len, m->in);
+
+  int c = getc(m->in);
+  if (c == EOF)
+    return 0;
+  buf[0] = (uint8_t)c;
+  size_t more = pending(m->in);
+  if (more > len - 1)
+    more = len - 1;
+  return 1 + (more > 0 ? fread(buf + 1, 1, more, m->in) : 0);
+}
+
+int io_get(ijvm *m)
+{
+  if (m->in_pos < m->in_end)
+    return m->in_buffer[m->in_pos++];
+
+  // bytes the caller handed over are read where they are
+  if (m->io.in_size > 0)
+  {
+    uint32_t len = m->io.in_size > UINT32_MAX ? UINT32_MAX : (uint32_t)m->io.in_size;
+    m->in_buffer = m->io.in_data;
+    m->in_pos = 1;
+    m->in_end = len;
+    m->io.in_data += len;
+    m->io.in_size -= len;
+    return m->in_buffer[0];
+  }
+  if (!m->in && !m->io.in_read)
+    return EOF;
+
+  // the refill may wait for input, so everything printed so far has to be
+  // out first
+  io_flush(m);
+  if (m->out)
+    fflush(m->out);
+
+  if (!m->in_block)
+  {
+    m->in_block = (uint8_t *)malloc(IN_BUFFER_SIZE);
+    if (!m->in_block)
+    {
+      uint8_t c;
+      return refill(m, &c, 1) == 1 ? c : EOF;
+    }
+  }
+
+  size_t got = refill(m, m->in_block, IN_BUFFER_SIZE);
+  m->in_buffer = m->in_block;
+  m->in_pos = 0;
+  m->in_end = got > IN_BUFFER_SIZE ? IN_BUFFER_SIZE : (uint32_t)got;
+  if (m->in_end == 0)
+    return EOF;
+  return m->in_buffer[m->in_pos++];
+}
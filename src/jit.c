@@ -0,0 +1,523 @@
+// mmap/mprotect and MAP_ANONYMOUS are not part of C11
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "ijvm_helper.h"
+#include "decode.h"
+#include "util.h"
+
+#if IJVM_HAVE_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// State shared between run_jit() and native code. The generated code keeps
+// sp in rbx, lv in r12, the frame in r13 and limit in r14; the offsets below
+// are baked into the templates.
+typedef struct JIT_FRAME {
+  word_t *sp;    // next free stack slot
+  word_t *lv;    // local variable 0 of the current frame
+  word_t *limit; // one past the last allocated stack slot
+  word_t pc;     // set by native code when it exits
+} jit_frame;
+
+#define FRAME_SP 0
+#define FRAME_LV 8
+#define FRAME_LIMIT 16
+#define FRAME_PC 24
+
+typedef void (*jit_enter_fn)(jit_frame *f, const uint8_t *target);
+
+// One mmap'd block of native code, holding a single compiled region
+typedef struct JIT_CHUNK {
+  uint8_t *mem;
+  size_t size;
+  struct JIT_CHUNK *next;
+} jit_chunk;
+
+// Per-pc entry point into native code
+typedef struct JIT_ENTRY {
+  const uint8_t *code;
+  jit_chunk *chunk;
+} jit_entry;
+
+struct JIT {
+  jit_entry *entries; // indexed by pc, code is NULL when not compiled
+  bool *visited;      // pc was part of a region (or found not compilable)
+  jit_chunk *chunks;
+};
+
+// Branch or fallthrough whose rel32 is patched once the region is laid out
+typedef struct FIXUP {
+  size_t at;
+  word_t target;
+} fixup;
+
+typedef struct EMITTER {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  bool overflow;
+  fixup *fixups;
+  size_t fixup_count;
+} emitter;
+
+// Upper bound of bytes emitted per instruction, including the jump that
+// replaces a fallthrough and the exit stubs of its branch targets.
+#define MAX_BYTES_PER_INSN 72
+#define MAX_BYTES_FIXED 256
+#define EXIT_STUB_BYTES 13
+
+static void emit8(emitter *e, uint8_t b)
+{
+  if (e->len >= e->cap)
+  {
+    e->overflow = true;
+    return;
+  }
+  e->buf[e->len++] = b;
+}
+
+static void emit_bytes(emitter *e, const uint8_t *bytes, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    emit8(e, bytes[i]);
+}
+
+static void emit32(emitter *e, uint32_t v)
+{
+  emit8(e, (uint8_t)v);
+  emit8(e, (uint8_t)(v >> 8));
+  emit8(e, (uint8_t)(v >> 16));
+  emit8(e, (uint8_t)(v >> 24));
+}
+
+static void patch32(emitter *e, size_t at, int32_t v)
+{
+  uint32_t u = (uint32_t)v;
+  e->buf[at] = (uint8_t)u;
+  e->buf[at + 1] = (uint8_t)(u >> 8);
+  e->buf[at + 2] = (uint8_t)(u >> 16);
+  e->buf[at + 3] = (uint8_t)(u >> 24);
+}
+
+// Emits a rel32 that will be pointed at the native code of target
+static void emit_fixup(emitter *e, word_t target)
+{
+  e->fixups[e->fixup_count].at = e->len;
+  e->fixups[e->fixup_count].target = target;
+  e->fixup_count++;
+  emit32(e, 0);
+}
+
+// Templates. sp = rbx, lv = r12, frame = r13, limit = r14.
+
+static const uint8_t T_PROLOGUE[] = {
+    0x53,                   // push rbx
+    0x41, 0x54,             // push r12
+    0x41, 0x55,             // push r13
+    0x41, 0x56,             // push r14
+    0x49, 0x89, 0xFD,       // mov r13, rdi
+    0x49, 0x8B, 0x5D, 0x00, // mov rbx, [r13 + FRAME_SP]
+    0x4D, 0x8B, 0x65, 0x08, // mov r12, [r13 + FRAME_LV]
+    0x4D, 0x8B, 0x75, 0x10, // mov r14, [r13 + FRAME_LIMIT]
+    0xFF, 0xE6,             // jmp rsi
+};
+
+static const uint8_t T_EPILOGUE[] = {
+    0x49, 0x89, 0x5D, 0x00, // mov [r13 + FRAME_SP], rbx
+    0x41, 0x5E,             // pop r14
+    0x41, 0x5D,             // pop r13
+    0x41, 0x5C,             // pop r12
+    0x5B,                   // pop rbx
+    0xC3,                   // ret
+};
+
+static const uint8_t T_SP_INC[] = {0x48, 0x83, 0xC3, 0x04}; // add rbx, 4
+static const uint8_t T_SP_DEC[] = {0x48, 0x83, 0xEB, 0x04}; // sub rbx, 4
+static const uint8_t T_SP_DEC2[] = {0x48, 0x83, 0xEB, 0x08}; // sub rbx, 8
+static const uint8_t T_LOAD_TOS[] = {0x8B, 0x43, 0xFC};   // mov eax, [rbx - 4]
+static const uint8_t T_STORE_EAX[] = {0x89, 0x03};        // mov [rbx], eax
+static const uint8_t T_CMP_TOS_0[] = {0x83, 0x3B, 0x00};  // cmp dword [rbx], 0
+
+// mov dword [r13 + FRAME_PC], pc; jmp epilogue
+static void emit_exit(emitter *e, word_t pc, size_t epilogue)
+{
+  const uint8_t set_pc[] = {0x41, 0xC7, 0x45, FRAME_PC};
+  emit_bytes(e, set_pc, sizeof(set_pc));
+  emit32(e, (uint32_t)pc);
+  emit8(e, 0xE9);
+  emit32(e, (uint32_t)((int64_t)epilogue - (int64_t)(e->len + 4)));
+}
+
+// Leaves native code at pc when there is no room for one more push
+static void emit_capacity_check(emitter *e, word_t pc, size_t epilogue)
+{
+  const uint8_t check[] = {
+      0x4C, 0x39, 0xF3,      // cmp rbx, r14
+      0x72, EXIT_STUB_BYTES, // jb over the exit stub
+  };
+  emit_bytes(e, check, sizeof(check));
+  emit_exit(e, pc, epilogue);
+}
+
+// Emits an instruction on [r12 + 4 * index], opcode bytes given
+static void emit_local_op(emitter *e, const uint8_t *op, size_t n, word_t index)
+{
+  emit8(e, 0x41);
+  emit_bytes(e, op, n);
+  emit8(e, 0x24);
+  emit32(e, (uint32_t)index * 4);
+}
+
+static void emit_push_imm(emitter *e, word_t pc, word_t value, size_t epilogue)
+{
+  emit_capacity_check(e, pc, epilogue);
+  emit8(e, 0xC7); // mov dword [rbx], imm32
+  emit8(e, 0x03);
+  emit32(e, (uint32_t)value);
+  emit_bytes(e, T_SP_INC, sizeof(T_SP_INC));
+}
+
+static void emit_binary(emitter *e, uint8_t opcode)
+{
+  emit_bytes(e, T_LOAD_TOS, sizeof(T_LOAD_TOS));
+  emit8(e, opcode); // <op> [rbx - 8], eax
+  emit8(e, 0x43);
+  emit8(e, 0xF8);
+  emit_bytes(e, T_SP_DEC, sizeof(T_SP_DEC));
+}
+
+static void emit_jcc(emitter *e, uint8_t cc, word_t target)
+{
+  emit8(e, 0x0F);
+  emit8(e, cc);
+  emit_fixup(e, target);
+}
+
+// Emits the native code of one supported instruction
+static void emit_insn(ijvm *m, emitter *e, word_t pc, const insn *in, size_t epilogue)
+{
+  switch (in->op)
+  {
+  case D_NOP:
+    break;
+  case D_BIPUSH:
+    emit_push_imm(e, pc, in->a, epilogue);
+    break;
+  case D_LDC_W:
+    emit_push_imm(e, pc, m->constant_data[in->a], epilogue);
+    break;
+  case D_DUP:
+    emit_capacity_check(e, pc, epilogue);
+    emit_bytes(e, T_LOAD_TOS, sizeof(T_LOAD_TOS));
+    emit_bytes(e, T_STORE_EAX, sizeof(T_STORE_EAX));
+    emit_bytes(e, T_SP_INC, sizeof(T_SP_INC));
+    break;
+  case D_IADD:
+    emit_binary(e, 0x01);
+    break;
+  case D_ISUB:
+    emit_binary(e, 0x29);
+    break;
+  case D_IAND:
+    emit_binary(e, 0x21);
+    break;
+  case D_IOR:
+    emit_binary(e, 0x09);
+    break;
+  case D_POP:
+    emit_bytes(e, T_SP_DEC, sizeof(T_SP_DEC));
+    break;
+  case D_SWAP:
+  {
+    const uint8_t swap[] = {
+        0x8B, 0x43, 0xFC, // mov eax, [rbx - 4]
+        0x8B, 0x4B, 0xF8, // mov ecx, [rbx - 8]
+        0x89, 0x43, 0xF8, // mov [rbx - 8], eax
+        0x89, 0x4B, 0xFC, // mov [rbx - 4], ecx
+    };
+    emit_bytes(e, swap, sizeof(swap));
+    break;
+  }
+  case D_GOTO:
+    emit8(e, 0xE9);
+    emit_fixup(e, in->a);
+    break;
+  case D_IFEQ:
+    emit_bytes(e, T_SP_DEC, sizeof(T_SP_DEC));
+    emit_bytes(e, T_CMP_TOS_0, sizeof(T_CMP_TOS_0));
+    emit_jcc(e, 0x84, in->a); // je
+    break;
+  case D_IFLT:
+    emit_bytes(e, T_SP_DEC, sizeof(T_SP_DEC));
+    emit_bytes(e, T_CMP_TOS_0, sizeof(T_CMP_TOS_0));
+    emit_jcc(e, 0x8C, in->a); // jl
+    break;
+  case D_IF_ICMPEQ:
+  {
+    const uint8_t cmp[] = {
+        0x8B, 0x03,       // mov eax, [rbx]
+        0x3B, 0x43, 0x04, // cmp eax, [rbx + 4]
+    };
+    emit_bytes(e, T_SP_DEC2, sizeof(T_SP_DEC2));
+    emit_bytes(e, cmp, sizeof(cmp));
+    emit_jcc(e, 0x84, in->a); // je
+    break;
+  }
+  case D_ILOAD:
+  {
+    const uint8_t load[] = {0x8B, 0x84}; // mov eax, [r12 + disp32]
+    emit_capacity_check(e, pc, epilogue);
+    emit_local_op(e, load, sizeof(load), in->a);
+    emit_bytes(e, T_STORE_EAX, sizeof(T_STORE_EAX));
+    emit_bytes(e, T_SP_INC, sizeof(T_SP_INC));
+    break;
+  }
+  case D_ISTORE:
+  {
+    const uint8_t store[] = {0x89, 0x84}; // mov [r12 + disp32], eax
+    emit_bytes(e, T_SP_DEC, sizeof(T_SP_DEC));
+    emit8(e, 0x8B); // mov eax, [rbx]
+    emit8(e, 0x03);
+    emit_local_op(e, store, sizeof(store), in->a);
+    break;
+  }
+  case D_IINC:
+  {
+    const uint8_t add[] = {0x81, 0x84}; // add dword [r12 + disp32], imm32
+    emit_local_op(e, add, sizeof(add), in->a);
+    emit32(e, (uint32_t)in->b);
+    break;
+  }
+  default:
+    emit_exit(e, pc, epilogue);
+    break;
+  }
+}
+
+static int compare_pc(const void *x, const void *y)
+{
+  word_t a = *(const word_t *)x;
+  word_t b = *(const word_t *)y;
+  return (a > b) - (a < b);
+}
+
+static void release_chunk(jit_chunk *c)
+{
+  munmap(c->mem, c->size);
+  free(c);
+}
+
+// Compiles the region starting at entry into a new chunk
+static void compile_region(ijvm *m, word_t entry)
+{
+  struct JIT *jit = m->jit;
+  word_t *region = (word_t *)malloc(sizeof(word_t) * m->text_size);
+  word_t *worklist = (word_t *)malloc(sizeof(word_t) * (2 * m->text_size + 1));
+  if (!region || !worklist)
+  {
+    free(region);
+    free(worklist);
+    return;
+  }
+
+  // pcs compiled by earlier regions stay marked in visited and are reached
+  // through their existing native code
+  uint32_t count = collect_reachable(m->program, entry, jit->visited, region, worklist);
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (count * MAX_BYTES_PER_INSN + MAX_BYTES_FIXED + page - 1) / page * page;
+
+  jit_chunk *chunk = (jit_chunk *)malloc(sizeof(jit_chunk));
+  fixup *fixups = (fixup *)malloc(sizeof(fixup) * (2 * count + 1));
+  size_t *native = (size_t *)malloc(sizeof(size_t) * (count + 1));
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (!chunk || !fixups || !native || mem == MAP_FAILED)
+  {
+    if (mem != MAP_FAILED)
+      munmap(mem, size);
+    free(chunk);
+    goto done;
+  }
+  chunk->mem = (uint8_t *)mem;
+  chunk->size = size;
+
+  emitter e = {chunk->mem, 0, size, false, fixups, 0};
+  emit_bytes(&e, T_PROLOGUE, sizeof(T_PROLOGUE));
+  size_t epilogue = e.len;
+  emit_bytes(&e, T_EPILOGUE, sizeof(T_EPILOGUE));
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    word_t pc = region[i];
+    const insn *in = &m->code[pc];
+    native[i] = e.len;
+    if (!insn_is_self_contained(m->program, in))
+    {
+      emit_exit(&e, pc, epilogue);
+      continue;
+    }
+    emit_insn(m, &e, pc, in, epilogue);
+    // the next instruction in layout order is not necessarily the next one
+    // in the program, so make the fallthrough explicit when needed
+    word_t next = pc + in->len;
+    if (insn_falls_through(in) && (i + 1 == count || region[i + 1] != next))
+    {
+      emit8(&e, 0xE9);
+      emit_fixup(&e, next);
+    }
+  }
+
+  // Resolve branches: into this region, into an older chunk within rel32
+  // range, or else to an exit stub that leaves native code at the target.
+  for (size_t f = 0; f < e.fixup_count && !e.overflow; f++)
+  {
+    word_t target = fixups[f].target;
+    const uint8_t *dest = NULL;
+    word_t *hit = (word_t *)bsearch(&target, region, count, sizeof(word_t), compare_pc);
+    if (hit)
+      dest = chunk->mem + native[hit - region];
+    else if ((uint32_t)target < m->text_size && jit->entries[target].code)
+    {
+      dest = jit->entries[target].code;
+      int64_t distance = dest - (chunk->mem + fixups[f].at + 4);
+      if (distance != (int32_t)distance)
+        dest = NULL;
+    }
+    if (!dest)
+    {
+      dest = chunk->mem + e.len;
+      emit_exit(&e, target, epilogue);
+    }
+    if (!e.overflow)
+      patch32(&e, fixups[f].at, (int32_t)(dest - (chunk->mem + fixups[f].at + 4)));
+  }
+
+  if (e.overflow || mprotect(chunk->mem, size, PROT_READ | PROT_EXEC) != 0)
+  {
+    release_chunk(chunk);
+    goto done;
+  }
+
+  chunk->next = jit->chunks;
+  jit->chunks = chunk;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (insn_is_self_contained(m->program, &m->code[region[i]]))
+    {
+      jit->entries[region[i]].code = chunk->mem + native[i];
+      jit->entries[region[i]].chunk = chunk;
+    }
+  }
+
+done:
+  free(native);
+  free(fixups);
+  free(worklist);
+  free(region);
+}
+
+bool jit_enable(ijvm *m)
+{
+  if (m->jit)
+    return true;
+
+  struct JIT *jit = (struct JIT *)malloc(sizeof(struct JIT));
+  if (!jit)
+    return false;
+  jit->entries = (jit_entry *)calloc(m->text_size + 1, sizeof(jit_entry));
+  jit->visited = (bool *)calloc(m->text_size + 1, sizeof(bool));
+  jit->chunks = NULL;
+  if (!jit->entries || !jit->visited)
+  {
+    free(jit->entries);
+    free(jit->visited);
+    free(jit);
+    return false;
+  }
+  m->jit = jit;
+  return true;
+}
+
+void jit_destroy(ijvm *m)
+{
+  struct JIT *jit = m->jit;
+  if (!jit)
+    return;
+
+  while (jit->chunks)
+  {
+    jit_chunk *next = jit->chunks->next;
+    release_chunk(jit->chunks);
+    jit->chunks = next;
+  }
+  free(jit->entries);
+  free(jit->visited);
+  free(jit);
+  m->jit = NULL;
+}
+
+// Native code for pc, compiling its region on the first visit
+static const jit_entry *lookup(ijvm *m)
+{
+  struct JIT *jit = m->jit;
+  uint32_t pc = (uint32_t)m->pc;
+
+  if (!jit->visited[pc])
+    compile_region(m, m->pc);
+  return jit->entries[pc].code ? &jit->entries[pc] : NULL;
+}
+
+void run_jit(ijvm *m)
+{
+  while (!finished(m))
+  {
+    const jit_entry *entry = lookup(m);
+    if (entry)
+    {
+      word_t *data = m->st->data;
+      jit_frame f = {data + m->st->index_top, data + m->lv, data + m->st->size, m->pc};
+      jit_enter_fn enter;
+      const uint8_t *start = entry->chunk->mem;
+      memcpy(&enter, &start, sizeof(enter));
+
+      enter(&f, entry->code);
+
+      m->st->index_top = (uint32_t)(f.sp - data);
+      m->pc = f.pc;
+      if (finished(m))
+        break;
+    }
+    step_buffered(m);
+  }
+}
+
+#else
+
+bool jit_enable(ijvm *m)
+{
+  (void)m;
+  return false;
+}
+
+void jit_destroy(ijvm *m)
+{
+  (void)m;
+}
+
+void run_jit(ijvm *m)
+{
+  while (!finished(m))
+    step_buffered(m);
+}
+
+#endif
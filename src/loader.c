@@ -0,0 +1,159 @@
+// mmap and fstat are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+#include "ijvm_helper.h"
+#include "util.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define HAVE_MMAP 0
+#endif
+
+static void clear_sections(ijvm_program *p)
+{
+  p->constant_data = NULL;
+  p->text_data = NULL;
+  p->text_owned = false;
+  p->mapping = NULL;
+  p->mapping_size = 0;
+}
+
+// Reads the origin and size of a section header at *offset and moves
+// *offset past the section, checking that all of it lies inside len bytes.
+// A truncated section is cut to the bytes present when truncated is set,
+// unless its size is beyond anything the binary could hold.
+static bool section(const uint8_t *buf, size_t len, size_t *offset, uint32_t *origin,
+                    uint32_t *size, bool truncated)
+{
+  if (len - *offset < 8)
+    return false;
+  *origin = read_uint32(buf + *offset);
+  *size = read_uint32(buf + *offset + 4);
+  *offset += 8;
+  if (len - *offset < *size)
+  {
+    if (!truncated || *size > len)
+      return false;
+    *size = (uint32_t)(len - *offset);
+  }
+  *offset += *size;
+  return true;
+}
+
+bool load_image(ijvm_program *p, const uint8_t *buf, size_t len)
+{
+  size_t offset = 4;
+  clear_sections(p);
+  if (len < 4)
+    return false;
+  p->magic_num = read_uint32(buf);
+  if (p->magic_num != MAGIC_NUMBER)
+    return false;
+
+  size_t constants = offset + 8;
+  if (!section(buf, len, &offset, &p->constant_origin, &p->constant_size, false))
+    return false;
+  // a text section cut short still runs up to where it stops (see
+  // check_insn() for instructions whose operands are missing)
+  size_t text = offset + 8;
+  if (!section(buf, len, &offset, &p->text_origin, &p->text_size, true))
+    return false;
+
+  uint32_t count = p->constant_size / 4;
+  p->constant_data = (word_t *)malloc(sizeof(word_t) * (count ? count : 1));
+  if (!p->constant_data)
+    return false;
+  read_uint32_array((uint32_t *)p->constant_data, buf + constants, count);
+
+  // never written to, the cast only drops const for the struct field
+  p->text_data = (uint8_t *)(uintptr_t)(buf + text);
+  return true;
+}
+
+// Maps path and loads it with load_image(). Returns false without touching
+// anything the stdio path needs when mapping is not possible.
+static bool load_mapped(ijvm_program *p, const char *path, bool *mapped)
+{
+  *mapped = false;
+#if HAVE_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return false;
+
+  *mapped = true;
+  if (!load_image(p, (const uint8_t *)base, (size_t)info.st_size))
+  {
+    free(p->constant_data);
+    munmap(base, (size_t)info.st_size);
+    clear_sections(p);
+    return false;
+  }
+  p->mapping = base;
+  p->mapping_size = (size_t)info.st_size;
+  return true;
+#else
+  (void)p;
+  (void)path;
+  return false;
+#endif
+}
+
+bool own_text(ijvm_program *p)
+{
+  uint8_t *copy = (uint8_t *)malloc(p->text_size ? p->text_size : 1);
+  if (!copy)
+    return false;
+  memcpy(copy, p->text_data, p->text_size);
+  p->text_data = copy;
+  p->text_owned = true;
+  return true;
+}
+
+bool load_binary(ijvm_program *p, const char *path)
+{
+  bool mapped;
+  if (load_mapped(p, path, &mapped))
+    return true;
+  if (mapped)
+    return false;
+
+  clear_sections(p);
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return false;
+  bool ok = read_magic_number(p, fp) && read_constant_pool(p, fp) && read_text_section(p, fp);
+  fclose(fp);
+  if (!ok)
+    unload_binary(p);
+  return ok;
+}
+
+void unload_binary(ijvm_program *p)
+{
+  free(p->constant_data);
+  if (p->text_owned)
+    free(p->text_data);
+#if HAVE_MMAP
+  if (p->mapping)
+    munmap(p->mapping, p->mapping_size);
+#endif
+  clear_sections(p);
+}
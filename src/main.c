@@ -1,26 +1,47 @@
 #include <stdio.h>
+#include <string.h>
 #include "ijvm.h"
+#include "jit.h"
+#include "aot.h"
 #include "util.h"
 static void print_help(void)
 { 
-  printf("Usage: ./ijvm binary \n"); 
+  printf("Usage: ./ijvm [--jit | --aot] binary \n"); 
 }
 
 int main(int argc, char **argv) 
 {
+  bool use_jit = false;
+  bool use_aot = false;
+  char *binary = NULL;
 
-  if (argc < 2) 
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--jit") == 0)
+      use_jit = true;
+    else if (strcmp(argv[i], "--aot") == 0)
+      use_aot = true;
+    else
+      binary = argv[i];
+  }
+
+  if (binary == NULL) 
   {
     print_help();
     return 1;
   }
-  ijvm* m = init_ijvm_std(argv[1]);
+  ijvm* m = init_ijvm_std(binary);
   if (m == NULL) 
   {
-    fprintf(stderr, "Couldn't load binary %s\n", argv[1]);
+    fprintf(stderr, "Couldn't load binary %s\n", binary);
     return 1;
   }
 
+  if (use_jit && !jit_enable(m))
+    fprintf(stderr, "JIT not available, interpreting %s\n", binary);
+  if (use_aot && !aot_enable(m, binary))
+    fprintf(stderr, "Couldn't build native code, interpreting %s\n", binary);
+
   run(m);
 
   destroy_ijvm(m);
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+
+#include "method.h"
+#include "decode.h"
+#include "util.h"
+
+#define UNVISITED INT32_MIN
+
+// Largest operand stack depth the analysis keeps track of
+#define MAX_TRACKED_STACK 65535
+
+typedef struct BUILDER {
+  int32_t *index_of; // table index of the method starting at each pc, or -1
+  int32_t *depth;    // stack depth on entry to each pc of the current method
+  word_t *visited;   // pcs whose depth is set, to reset them afterwards
+  word_t *worklist;
+  uint32_t capacity;
+} builder;
+
+// Adds the method whose header starts at offset header, unless it is
+// already in the table. Returns its index, or -1 when the header does not
+// fit in the text or the table cannot grow.
+static int32_t add_method(ijvm_program *p, builder *b, word_t header)
+{
+  if (header < 0 || p->text_size < 4 || (uint32_t)header > p->text_size - 4)
+    return -1;
+  word_t entry = header + 4;
+  if ((uint32_t)entry < p->text_size && b->index_of[entry] >= 0)
+    return b->index_of[entry];
+
+  if (p->method_count == b->capacity)
+  {
+    method *grown = (method *)realloc(p->methods, sizeof(method) * b->capacity * 2);
+    if (!grown)
+      return -1;
+    p->methods = grown;
+    b->capacity *= 2;
+  }
+
+  method *me = &p->methods[p->method_count];
+  me->entry = entry;
+  me->args = read_uint16(p->text_data + header);
+  me->locals = read_uint16(p->text_data + header + 2);
+  if ((uint32_t)entry < p->text_size)
+    b->index_of[entry] = (int32_t)p->method_count;
+  return (int32_t)p->method_count++;
+}
+
+// Walks the code of method index, recording the stack depth at every pc it
+// reaches and adding the methods it calls to the table.
+static void analyse(ijvm_program *p, builder *b, uint32_t index)
+{
+  word_t entry = p->methods[index].entry;
+  uint32_t visited = 0;
+  uint32_t pending = 0;
+  int32_t max_stack = 0;
+  uint32_t max_local = 0;
+  bool known = true;
+
+  if ((uint32_t)entry < p->text_size)
+  {
+    b->depth[entry] = 0;
+    b->visited[visited++] = entry;
+    b->worklist[pending++] = entry;
+  }
+
+  while (pending > 0)
+  {
+    word_t pc = b->worklist[--pending];
+    const insn *in = &p->code[pc];
+    int32_t pops;
+    int32_t pushes;
+    insn_stack_effect(in, &pops, &pushes);
+
+    switch (in->op)
+    {
+    case D_ILOAD:
+    case D_ISTORE:
+    case D_IINC:
+      max_local = (uint32_t)in->a + 1 > max_local ? (uint32_t)in->a + 1 : max_local;
+      break;
+    case D_INVOKEVIRTUAL:
+    {
+      int32_t callee = -1;
+      if ((uint32_t)in->a < p->constant_size / 4)
+        callee = add_method(p, b, p->constant_data[in->a]);
+      if (callee < 0)
+        known = false;
+      else
+        pops = p->methods[callee].args;
+      break;
+    }
+    default:
+      break;
+    }
+
+    int32_t d = b->depth[pc];
+    if (d < pops)
+    {
+      known = false;
+      d = pops;
+    }
+    d += pushes - pops;
+    if (d > MAX_TRACKED_STACK)
+    {
+      known = false;
+      d = MAX_TRACKED_STACK;
+    }
+    max_stack = d > max_stack ? d : max_stack;
+
+    word_t next[2];
+    int count = 0;
+    if (insn_is_branch(in))
+      next[count++] = in->a;
+    if (insn_falls_through(in))
+      next[count++] = pc + in->len;
+    for (int i = 0; i < count; i++)
+    {
+      // leaving the text ends the machine, there is nothing to track
+      if ((uint32_t)next[i] >= p->text_size)
+        continue;
+      if (b->depth[next[i]] == UNVISITED)
+      {
+        b->depth[next[i]] = d;
+        b->visited[visited++] = next[i];
+        b->worklist[pending++] = next[i];
+      }
+      else if (b->depth[next[i]] != d)
+      {
+        known = false;
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < visited; i++)
+    b->depth[b->visited[i]] = UNVISITED;
+
+  method *me = &p->methods[index];
+  if (index == 0)
+    me->locals = max_local > UINT16_MAX ? UINT16_MAX : (uint16_t)max_local;
+  me->max_stack = known ? max_stack : METHOD_STACK_UNKNOWN;
+  me->reserve = (uint32_t)me->locals + 1 + (known ? (uint32_t)max_stack : 0);
+}
+
+static int compare_entry(const void *x, const void *y)
+{
+  word_t a = ((const method *)x)->entry;
+  word_t b = ((const method *)y)->entry;
+  return (a > b) - (a < b);
+}
+
+bool build_method_table(ijvm_program *p)
+{
+  uint32_t size = p->text_size;
+  builder b;
+  b.capacity = 16;
+  b.index_of = (int32_t *)malloc(sizeof(int32_t) * (size + 1));
+  b.depth = (int32_t *)malloc(sizeof(int32_t) * (size + 1));
+  b.visited = (word_t *)malloc(sizeof(word_t) * (size + 1));
+  b.worklist = (word_t *)malloc(sizeof(word_t) * (size + 1));
+  p->methods = (method *)malloc(sizeof(method) * b.capacity);
+  p->method_count = 0;
+  bool ok = b.index_of && b.depth && b.visited && b.worklist && p->methods;
+
+  if (ok)
+  {
+    for (uint32_t pc = 0; pc < size; pc++)
+    {
+      b.index_of[pc] = -1;
+      b.depth[pc] = UNVISITED;
+    }
+
+    // main, whose "header" would sit just before the text
+    method *main_method = &p->methods[p->method_count++];
+    main_method->entry = 0;
+    main_method->args = 0;
+    main_method->locals = 0;
+    if (size > 0)
+      b.index_of[0] = 0;
+
+    for (uint32_t i = 0; i < p->method_count; i++)
+      analyse(p, &b, i);
+    qsort(p->methods, p->method_count, sizeof(method), compare_entry);
+  }
+  else
+  {
+    free(p->methods);
+    p->methods = NULL;
+  }
+
+  free(b.worklist);
+  free(b.visited);
+  free(b.depth);
+  free(b.index_of);
+  return ok;
+}
+
+int32_t find_method(ijvm_program *p, word_t entry)
+{
+  uint32_t lo = 0;
+  uint32_t hi = p->method_count;
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (p->methods[mid].entry < entry)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < p->method_count && p->methods[lo].entry == entry ? (int32_t)lo : -1;
+}
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ijvm_ext.h"
+#include "program.h"
+#include "program_cache.h"
+#include "image_cache.h"
+#include "loader.h"
+#include "decode.h"
+#include "method.h"
+#include "verify.h"
+#include "util.h"
+
+static ijvm_program *new_program(void)
+{
+  ijvm_program *p = (ijvm_program *)malloc(sizeof(ijvm_program));
+  if (!p)
+    return NULL;
+  p->code = NULL;
+  p->run_cost = NULL;
+  p->methods = NULL;
+  p->method_count = 0;
+  p->image = NULL;
+  p->image_size = 0;
+  p->path = NULL;
+  return p;
+}
+
+static void free_program(ijvm_program *p)
+{
+  unload_binary(p);
+  if (p->image)
+  {
+    image_cache_unload(p);
+  }
+  else
+  {
+    free(p->code);
+    free(p->methods);
+  }
+  free(p->run_cost);
+  free(p->path);
+  free(p);
+}
+
+// Finishes p once load_binary() or load_image() ran, loaded telling whether
+// that worked. On failure p is released and NULL returned.
+static ijvm_program *finish_program(ijvm_program *p, bool loaded)
+{
+  bool use_cache = loaded && image_cache_enabled();
+  bool cached = use_cache && image_cache_load(p);
+
+  if (!cached)
+  {
+    if (!loaded || !decode_text(p) || !build_method_table(p))
+    {
+      free_program(p);
+      return NULL;
+    }
+
+    // resolving everything now is what keeps the stream read-only afterwards
+    quicken_text(p);
+    p->verified = verify_program(p);
+    if (use_cache)
+      image_cache_store(p);
+  }
+
+  // cheap enough not to be worth a place in the image
+  if (!measure_runs(p))
+  {
+    free_program(p);
+    return NULL;
+  }
+  atomic_init(&p->refs, 1);
+  return p;
+}
+
+ijvm_program *load_program_file(const char *binary_path)
+{
+  ijvm_program *p = new_program();
+  if (!p)
+    return NULL;
+
+  size_t len = strlen(binary_path) + 1;
+  p->path = (char *)malloc(len);
+  if (!p->path)
+  {
+    free(p);
+    return NULL;
+  }
+  memcpy(p->path, binary_path, len);
+  return finish_program(p, load_binary(p, binary_path));
+}
+
+ijvm_program *load_program(const char *binary_path)
+{
+  if (program_cache_enabled())
+    return program_cache_load(binary_path);
+  return load_program_file(binary_path);
+}
+
+static ijvm_program *load_from_memory(const uint8_t *buf, size_t len, bool borrow)
+{
+  ijvm_program *p = new_program();
+  if (!p)
+    return NULL;
+  return finish_program(p, load_image(p, buf, len) && (borrow || own_text(p)));
+}
+
+ijvm_program *load_program_from_memory(const uint8_t *buf, size_t len)
+{
+  return load_from_memory(buf, len, false);
+}
+
+ijvm_program *load_program_from_memory_borrowed(const uint8_t *buf, size_t len)
+{
+  return load_from_memory(buf, len, true);
+}
+
+ijvm_program *retain_program(ijvm_program *p)
+{
+  atomic_fetch_add_explicit(&p->refs, 1, memory_order_relaxed);
+  return p;
+}
+
+void release_program(ijvm_program *p)
+{
+  // the last owner has to see every write the others made before letting go
+  if (atomic_fetch_sub_explicit(&p->refs, 1, memory_order_acq_rel) == 1)
+    free_program(p);
+}
+
+unsigned int get_program_references(ijvm_program *p)
+{
+  return atomic_load_explicit(&p->refs, memory_order_relaxed);
+}
+
+bool is_program_verified(ijvm_program *p)
+{
+  return p->verified;
+}
+
+size_t program_footprint(const ijvm_program *p)
+{
+  size_t bytes = sizeof(ijvm_program) + sizeof(word_t) * (p->constant_size / 4);
+  if (p->image)
+    bytes += p->image_size;
+  else
+    bytes += sizeof(insn) * (p->text_size + CODE_PADDING) + sizeof(method) * p->method_count;
+  bytes += sizeof(uint32_t) * (p->text_size + CODE_PADDING);
+  if (p->mapping)
+    bytes += p->mapping_size;
+  else if (p->text_owned)
+    bytes += p->text_size;
+  return bytes;
+}
+
+uint64_t program_hash(const ijvm_program *p)
+{
+  uint64_t h = hash_bytes(p->text_data, p->text_size, HASH_SEED);
+  return hash_bytes((const uint8_t *)p->constant_data, p->constant_size / 4 * sizeof(word_t), h);
+}
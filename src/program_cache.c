@@ -0,0 +1,208 @@
+// stat's nanosecond timestamps and pthreads are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "program_cache.h"
+#include "program.h"
+#include "image_cache.h"
+#include "ijvm_ext.h"
+
+typedef struct FILE_KEY {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  long mtime_nsec;
+} file_key;
+
+// One cached program. Entries form a list, most recently used first.
+typedef struct ENTRY {
+  file_key key;
+  ijvm_program *program;
+  size_t bytes;
+  struct ENTRY *prev;
+  struct ENTRY *next;
+} entry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static entry *head = NULL;
+static entry *tail = NULL;
+static size_t limit = 0;
+static bool limit_set = false;
+static program_cache_stats stats = {0, 0, 0, 0, 0, 0};
+
+static bool key_of(const char *path, file_key *key)
+{
+  struct stat info;
+  if (stat(path, &info) != 0)
+    return false;
+  key->dev = info.st_dev;
+  key->ino = info.st_ino;
+  key->size = info.st_size;
+#ifdef __APPLE__
+  key->mtime = info.st_mtimespec.tv_sec;
+  key->mtime_nsec = info.st_mtimespec.tv_nsec;
+#else
+  key->mtime = info.st_mtim.tv_sec;
+  key->mtime_nsec = info.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+static bool same_key(const file_key *a, const file_key *b)
+{
+  return a->dev == b->dev && a->ino == b->ino && a->size == b->size && a->mtime == b->mtime &&
+         a->mtime_nsec == b->mtime_nsec;
+}
+
+static void unlink_entry(entry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    tail = e->prev;
+}
+
+static void push_front(entry *e)
+{
+  e->prev = NULL;
+  e->next = head;
+  if (head)
+    head->prev = e;
+  else
+    tail = e;
+  head = e;
+}
+
+static void drop(entry *e)
+{
+  unlink_entry(e);
+  stats.entries--;
+  stats.bytes -= e->bytes;
+  release_program(e->program);
+  free(e);
+}
+
+// Evicts from the cold end until the cache fits in limit. Called with the
+// lock held.
+static void shrink(void)
+{
+  while (tail && stats.bytes > limit)
+  {
+    drop(tail);
+    stats.evictions++;
+  }
+}
+
+// Reads IJVM_PROGRAM_CACHE the first time it matters, unless the limit was
+// set explicitly. Called with the lock held.
+static void read_env(void)
+{
+  if (limit_set)
+    return;
+  limit_set = true;
+  char *mib = getenv("IJVM_PROGRAM_CACHE");
+  if (mib && *mib)
+    limit = (size_t)strtoull(mib, NULL, 10) << 20;
+  stats.limit = limit;
+}
+
+bool program_cache_enabled(void)
+{
+  pthread_mutex_lock(&lock);
+  read_env();
+  bool enabled = limit > 0;
+  pthread_mutex_unlock(&lock);
+  return enabled;
+}
+
+ijvm_program *program_cache_load(const char *path)
+{
+  file_key key;
+  if (!key_of(path, &key))
+    return NULL;
+
+  pthread_mutex_lock(&lock);
+  for (entry *e = head; e; e = e->next)
+  {
+    if (same_key(&e->key, &key))
+    {
+      // the binary is the same, but the image cache file under its code
+      // was written in place: load it again rather than run that
+      if (e->program->image && image_cache_changed(e->program))
+      {
+        drop(e);
+        break;
+      }
+      unlink_entry(e);
+      push_front(e);
+      stats.hits++;
+      ijvm_program *p = retain_program(e->program);
+      pthread_mutex_unlock(&lock);
+      return p;
+    }
+  }
+  stats.misses++;
+  pthread_mutex_unlock(&lock);
+
+  // loading happens outside the lock, so two threads missing on the same
+  // file at once both load it and the second insert is dropped below
+  ijvm_program *p = load_program_file(path);
+  if (!p)
+    return NULL;
+
+  // a file rewritten while it was being loaded is not worth remembering
+  file_key after;
+  if (!key_of(path, &after) || !same_key(&key, &after))
+    return p;
+
+  entry *e = (entry *)malloc(sizeof(entry));
+  if (!e)
+    return p;
+  e->key = key;
+  e->program = retain_program(p);
+  e->bytes = program_footprint(p);
+
+  pthread_mutex_lock(&lock);
+  bool present = false;
+  for (entry *other = head; other && !present; other = other->next)
+    present = same_key(&other->key, &key);
+  if (present || e->bytes > limit)
+  {
+    pthread_mutex_unlock(&lock);
+    release_program(e->program);
+    free(e);
+    return p;
+  }
+  push_front(e);
+  stats.entries++;
+  stats.bytes += e->bytes;
+  shrink();
+  pthread_mutex_unlock(&lock);
+  return p;
+}
+
+void set_program_cache_limit(size_t bytes)
+{
+  pthread_mutex_lock(&lock);
+  limit_set = true;
+  limit = bytes;
+  stats.limit = bytes;
+  shrink();
+  pthread_mutex_unlock(&lock);
+}
+
+void get_program_cache_stats(program_cache_stats *out)
+{
+  pthread_mutex_lock(&lock);
+  read_env();
+  *out = stats;
+  pthread_mutex_unlock(&lock);
+}
@@ -1,5 +1,14 @@
 #include "util.h"
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_X86_SHUFFLE 1
+#else
+#define HAVE_X86_SHUFFLE 0
+#endif
 // Endianness helper functions
 
 uint32_t swap_uint32(uint32_t num)
@@ -21,22 +30,143 @@ int32_t swap_int32(int32_t num) {
   return (int32_t)swap_uint32((uint32_t)num);
 }
 
-uint32_t read_uint32(uint8_t *buf)
+uint32_t read_uint32(const uint8_t *buf)
 {
   return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
          ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
 }
 
-uint16_t read_uint16(uint8_t *buf)
+uint16_t read_uint16(const uint8_t *buf)
 {
   return (uint16_t)((uint16_t)buf[0] << 8) | (uint16_t)buf[1];
 }
 
 
-int32_t read_int32(uint8_t* buf) {
+int32_t read_int32(const uint8_t *buf) {
   return (int32_t) read_uint32(buf);
 }
 
-int16_t read_int16(uint8_t* buf) {
+int16_t read_int16(const uint8_t *buf) {
   return (int16_t) read_uint16(buf);
 }
+
+void read_uint32_array_scalar(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    dst[i] = read_uint32(src + 4 * i);
+}
+
+#if HAVE_X86_SHUFFLE
+// The vector loops use unaligned loads and stores and finish the tail with
+// the scalar loop. A whole vector is loaded before it is stored, so
+// converting in place works.
+
+__attribute__((target("avx2")))
+static void read_uint32_array_avx2(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i words = _mm256_loadu_si256((const __m256i *)(const void *)(src + 4 * i));
+    _mm256_storeu_si256((__m256i *)(void *)(dst + i), _mm256_shuffle_epi8(words, swap));
+  }
+  read_uint32_array_scalar(dst + i, src + 4 * i, count - i);
+}
+
+__attribute__((target("ssse3")))
+static void read_uint32_array_ssse3(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i words = _mm_loadu_si128((const __m128i *)(const void *)(src + 4 * i));
+    _mm_storeu_si128((__m128i *)(void *)(dst + i), _mm_shuffle_epi8(words, swap));
+  }
+  read_uint32_array_scalar(dst + i, src + 4 * i, count - i);
+}
+#endif
+
+typedef void (*read_uint32_array_fn)(uint32_t *dst, const uint8_t *src, size_t count);
+
+typedef struct BSWAP_VARIANT {
+  const char *name;
+  read_uint32_array_fn impl;
+} bswap_variant;
+
+// Best first, so the first one the CPU has is the one picked
+static const bswap_variant variants[] = {
+#if HAVE_X86_SHUFFLE
+  {"avx2", read_uint32_array_avx2},
+  {"ssse3", read_uint32_array_ssse3},
+#endif
+  {"scalar", read_uint32_array_scalar},
+};
+#define VARIANT_COUNT (sizeof(variants) / sizeof(variants[0]))
+
+// Filled in once, by whichever thread gets there first; pthread_once()
+// makes them visible to every other caller
+static pthread_once_t picked = PTHREAD_ONCE_INIT;
+static bool supported[VARIANT_COUNT];
+static const bswap_variant *best;
+
+static bool cpu_supports(const char *name)
+{
+#if HAVE_X86_SHUFFLE
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+  if (strcmp(name, "ssse3") == 0)
+    return __builtin_cpu_supports("ssse3");
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+static void pick_read_uint32_array(void)
+{
+  for (size_t i = VARIANT_COUNT; i-- > 0;)
+  {
+    supported[i] = cpu_supports(variants[i].name);
+    if (supported[i])
+      best = &variants[i];
+  }
+}
+
+void read_uint32_array(uint32_t *dst, const uint8_t *src, size_t count)
+{
+  pthread_once(&picked, pick_read_uint32_array);
+  best->impl(dst, src, count);
+}
+
+const char *read_uint32_array_variant(void)
+{
+  pthread_once(&picked, pick_read_uint32_array);
+  return best->name;
+}
+
+bool read_uint32_array_with(const char *variant, uint32_t *dst, const uint8_t *src,
+                            size_t count)
+{
+  pthread_once(&picked, pick_read_uint32_array);
+  for (size_t i = 0; i < VARIANT_COUNT; i++)
+  {
+    if (strcmp(variants[i].name, variant) == 0 && supported[i])
+    {
+      variants[i].impl(dst, src, count);
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t hash_bytes(const uint8_t *buf, size_t len, uint64_t h)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= buf[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+
+#include "verify.h"
+#include "decode.h"
+
+#define UNVISITED INT32_MIN
+
+// Depths above this are tracked as this, which only makes the bound lower
+#define MAX_TRACKED_STACK 65535
+
+// Everything about the instruction at pc that does not depend on the stack
+static bool valid_insn(const ijvm_program *p, const method *me, word_t pc, const insn *in)
+{
+  if (in->op == D_SKIP || (uint32_t)pc + in->len > p->text_size)
+    return false;
+  if (insn_is_branch(in) && (in->a < 0 || (uint32_t)in->a > p->text_size))
+    return false;
+
+  switch (in->op)
+  {
+  case D_ILOAD:
+  case D_ISTORE:
+  case D_IINC:
+    // main has no header, its local count already covers every index
+    return (uint32_t)in->a < (uint32_t)me->args + me->locals;
+  case D_LDC_W:
+    return (uint32_t)in->a < p->constant_size / 4;
+  case D_INVOKEVIRTUAL:
+    return in->xop == D_INVOKEVIRTUAL_QUICK;
+  default:
+    return true;
+  }
+}
+
+static bool verify_method(const ijvm_program *p, const method *me, int32_t *low, bool *queued,
+                          word_t *worklist)
+{
+  uint32_t pending = 0;
+  bool ok = true;
+
+  if ((uint32_t)me->entry < p->text_size)
+  {
+    low[me->entry] = 0;
+    queued[me->entry] = true;
+    worklist[pending++] = me->entry;
+  }
+
+  while (pending > 0 && ok)
+  {
+    word_t pc = worklist[--pending];
+    queued[pc] = false;
+    const insn *in = &p->code[pc];
+    if (!valid_insn(p, me, pc, in))
+    {
+      ok = false;
+      break;
+    }
+
+    int32_t pops;
+    int32_t pushes;
+    insn_stack_effect(in, &pops, &pushes);
+    if (in->op == D_INVOKEVIRTUAL)
+      pops = p->methods[in->c].args;
+    if (low[pc] < pops)
+    {
+      ok = false;
+      break;
+    }
+    int32_t d = low[pc] - pops + pushes;
+    d = d > MAX_TRACKED_STACK ? MAX_TRACKED_STACK : d;
+
+    // a pc is walked again whenever a lower depth reaches it; depths only
+    // go down and never below zero, so this ends
+    word_t next[2];
+    int count = 0;
+    if (insn_is_branch(in))
+      next[count++] = in->a;
+    if (insn_falls_through(in))
+      next[count++] = pc + in->len;
+    for (int i = 0; i < count; i++)
+    {
+      // leaving the text ends the machine
+      if ((uint32_t)next[i] >= p->text_size)
+        continue;
+      if (low[next[i]] == UNVISITED || d < low[next[i]])
+      {
+        low[next[i]] = d;
+        if (!queued[next[i]])
+        {
+          queued[next[i]] = true;
+          worklist[pending++] = next[i];
+        }
+      }
+    }
+  }
+
+  for (uint32_t pc = 0; pc < p->text_size; pc++)
+  {
+    low[pc] = UNVISITED;
+    queued[pc] = false;
+  }
+  return ok;
+}
+
+bool verify_program(const ijvm_program *p)
+{
+  uint32_t size = p->text_size;
+  int32_t *low = (int32_t *)malloc(sizeof(int32_t) * (size + 1));
+  bool *queued = (bool *)malloc(size + 1);
+  word_t *worklist = (word_t *)malloc(sizeof(word_t) * (size + 1));
+  bool ok = low && queued && worklist;
+
+  if (ok)
+  {
+    for (uint32_t pc = 0; pc < size; pc++)
+    {
+      low[pc] = UNVISITED;
+      queued[pc] = false;
+    }
+    for (uint32_t i = 0; i < p->method_count && ok; i++)
+      ok = verify_method(p, &p->methods[i], low, queued, worklist);
+  }
+
+  free(worklist);
+  free(queued);
+  free(low);
+  return ok;
+}
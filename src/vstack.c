@@ -0,0 +1,183 @@
+// mmap, mincore, sigaction and sigsetjmp are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+
+#include "vstack.h"
+
+#if IJVM_HAVE_VSTACK
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// One active vstack_protect() call. They nest when run() steps the machine
+// through step(), and are per thread.
+typedef struct SCOPE {
+  sigjmp_buf env;
+  const stack *st;
+  struct SCOPE *prev;
+} scope;
+
+static _Thread_local scope *current;
+
+// The handler is installed once per process and stays: other threads may
+// be inside vstack_protect() whenever any fault comes in. previous is what
+// it replaced, and gets the faults that are not a stack overflow.
+static pthread_once_t install_once = PTHREAD_ONCE_INIT;
+static struct sigaction previous;
+static bool installed = false;
+
+static size_t page_size(void)
+{
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void on_segv(int sig, siginfo_t *info, void *context)
+{
+  const uint8_t *addr = (const uint8_t *)info->si_addr;
+  for (scope *s = current; s; s = s->prev)
+  {
+    const uint8_t *guard = (const uint8_t *)(s->st->data + s->st->size);
+    if (addr >= guard && addr < guard + VSTACK_GUARD_BYTES)
+      siglongjmp(s->env, 1);
+  }
+
+  // Not an IJVM stack overflow: pass it on to whatever handled SIGSEGV
+  // before. Without a handler of its own the fault is fatal, so the default
+  // action is put back and the faulting instruction runs into it.
+  if (previous.sa_flags & SA_SIGINFO)
+  {
+    previous.sa_sigaction(sig, info, context);
+  }
+  else if (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN)
+  {
+    signal(SIGSEGV, SIG_DFL);
+  }
+  else
+  {
+    previous.sa_handler(sig);
+  }
+}
+
+static void install_handler(void)
+{
+  struct sigaction sa;
+  sa.sa_sigaction = on_segv;
+  sigemptyset(&sa.sa_mask);
+  // SA_NODEFER leaves SIGSEGV unblocked after the siglongjmp, so the
+  // protect scope does not need to save the signal mask on every entry
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  // previous is complete before a fault can reach on_segv()
+  installed = sigaction(SIGSEGV, NULL, &previous) == 0 && sigaction(SIGSEGV, &sa, NULL) == 0;
+}
+
+bool vstack_create(stack *st)
+{
+  size_t guard = (VSTACK_GUARD_BYTES + page_size() - 1) / page_size() * page_size();
+  uint8_t *base = (uint8_t *)mmap(NULL, VSTACK_RESERVE_BYTES + guard, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+    return false;
+
+  pthread_once(&install_once, install_handler);
+  if (mprotect(base + VSTACK_RESERVE_BYTES, guard, PROT_NONE) != 0 || !installed)
+  {
+    munmap(base, VSTACK_RESERVE_BYTES + guard);
+    return false;
+  }
+
+  st->data = (word_t *)base;
+  st->size = (uint32_t)(VSTACK_RESERVE_BYTES / sizeof(word_t));
+  st->mapped = true;
+  return true;
+}
+
+void vstack_destroy(stack *st)
+{
+  size_t guard = (VSTACK_GUARD_BYTES + page_size() - 1) / page_size() * page_size();
+  munmap(st->data, VSTACK_RESERVE_BYTES + guard);
+}
+
+size_t vstack_committed_bytes(const stack *st)
+{
+  size_t page = page_size();
+  size_t pages = VSTACK_RESERVE_BYTES / page;
+  unsigned char *resident = (unsigned char *)malloc(pages);
+  if (!resident)
+    return 0;
+
+  size_t committed = 0;
+#ifdef __APPLE__
+  int status = mincore(st->data, VSTACK_RESERVE_BYTES, (char *)resident);
+#else
+  int status = mincore(st->data, VSTACK_RESERVE_BYTES, resident);
+#endif
+  if (status == 0)
+  {
+    for (size_t i = 0; i < pages; i++)
+      committed += resident[i] & 1;
+  }
+  free(resident);
+  return committed * page;
+}
+
+void vstack_protect(ijvm *m, void (*fn)(ijvm *m, void *arg), void *arg)
+{
+  scope s;
+  s.st = m->st;
+  s.prev = current;
+  if (sigsetjmp(s.env, 0) == 0)
+  {
+    current = &s;
+    fn(m, arg);
+  }
+  else
+  {
+    m->is_finished = true;
+  }
+  current = s.prev;
+}
+
+void vstack_overflow(ijvm *m)
+{
+  for (scope *s = current; s; s = s->prev)
+  {
+    if (s->st == m->st)
+      siglongjmp(s->env, 1);
+  }
+  m->is_finished = true;
+}
+
+#else
+
+bool vstack_create(stack *st)
+{
+  (void)st;
+  return false;
+}
+
+void vstack_destroy(stack *st)
+{
+  (void)st;
+}
+
+size_t vstack_committed_bytes(const stack *st)
+{
+  (void)st;
+  return 0;
+}
+
+void vstack_protect(ijvm *m, void (*fn)(ijvm *m, void *arg), void *arg)
+{
+  fn(m, arg);
+}
+
+void vstack_overflow(ijvm *m)
+{
+  m->is_finished = true;
+}
+
+#endif
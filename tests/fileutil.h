@@ -0,0 +1,19 @@
+#ifndef FILEUTIL_H
+#define FILEUTIL_H
+#include <stdio.h>
+#include "testutil.h"
+
+// Copies the file at from to to, for tests that need a binary of their own
+static void copy_file(const char *from, const char *to)
+{
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    assert(in != NULL && out != NULL);
+    int c;
+    while ((c = fgetc(in)) != EOF)
+        fputc(c, out);
+    fclose(in);
+    fclose(out);
+}
+
+#endif
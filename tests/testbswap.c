@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../include/ijvm.h"
+#include "../include/util.h"
+#include "testutil.h"
+
+/* testbswap
+
+Checks read_uint32_array(), and each variant this CPU has, against the
+word-at-a-time loop for every length around the vector widths, in place,
+at odd source alignments and on a pool of a million words.
+
+Built with USERFLAGS=-DBSWAP_BENCH (e.g. USERFLAGS=-DBSWAP_BENCH make
+testbswap), it also times both on that pool, outside the tests.
+
+*/
+
+#define POOL_WORDS (1u << 20)
+
+// NULL is whichever variant read_uint32_array() picked
+static const char *variants[] = {NULL, "scalar", "ssse3", "avx2"};
+#define VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+// Converts with variant, false when the CPU does not have it
+static bool convert(const char *variant, uint32_t *dst, const uint8_t *src, size_t count)
+{
+    if (!variant)
+    {
+        read_uint32_array(dst, src, count);
+        return true;
+    }
+    return read_uint32_array_with(variant, dst, src, count);
+}
+
+static uint32_t reference(const uint8_t *src, size_t i)
+{
+    return read_uint32(src + 4 * i);
+}
+
+void test_matches_scalar(void)
+{
+    uint8_t bytes[4 * 64 + 3];
+    uint32_t out[64];
+    for (size_t i = 0; i < sizeof(bytes); i++)
+        bytes[i] = (uint8_t)(i * 37 + 11);
+
+    for (size_t v = 0; v < VARIANTS; v++)
+    {
+        if (!convert(variants[v], out, bytes, 0))
+            continue;
+        for (size_t align = 0; align < 4; align++)
+        {
+            for (size_t count = 0; count <= 64; count++)
+            {
+                assert(convert(variants[v], out, bytes + align, count));
+                for (size_t i = 0; i < count; i++)
+                    assert(out[i] == reference(bytes + align, i));
+            }
+        }
+    }
+
+    // scalar is always there, and unknown names never are
+    assert(read_uint32_array_with("scalar", out, bytes, 1));
+    assert(!read_uint32_array_with("neon", out, bytes, 1));
+}
+
+void test_in_place(void)
+{
+    for (size_t v = 0; v < VARIANTS; v++)
+    {
+        uint32_t words[37];
+        uint8_t copy[sizeof(words)];
+        for (size_t i = 0; i < sizeof(words); i++)
+            copy[i] = ((uint8_t *)words)[i] = (uint8_t)(i * 13 + 1);
+
+        if (!convert(variants[v], words, (const uint8_t *)words, 37))
+            continue;
+        for (size_t i = 0; i < 37; i++)
+            assert(words[i] == reference(copy, i));
+    }
+}
+
+static uint8_t *make_pool(void)
+{
+    uint8_t *src = (uint8_t *)malloc(4 * POOL_WORDS);
+    for (size_t i = 0; src && i < 4 * POOL_WORDS; i++)
+        src[i] = (uint8_t)(i * 7 + (i >> 12));
+    return src;
+}
+
+void test_pool(void)
+{
+    uint8_t *src = make_pool();
+    uint32_t *dst = (uint32_t *)malloc(sizeof(uint32_t) * POOL_WORDS);
+    assert(src && dst);
+
+    for (size_t v = 0; v < VARIANTS; v++)
+    {
+        memset(dst, 0, sizeof(uint32_t) * POOL_WORDS);
+        if (!convert(variants[v], dst, src, POOL_WORDS))
+            continue;
+        for (size_t i = 0; i < POOL_WORDS; i++)
+            assert(dst[i] == reference(src, i));
+    }
+
+    free(dst);
+    free(src);
+}
+
+#ifdef BSWAP_BENCH
+static double seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_pool(void)
+{
+    uint8_t *src = make_pool();
+    uint32_t *dst = (uint32_t *)malloc(sizeof(uint32_t) * POOL_WORDS);
+    if (!src || !dst)
+        return;
+
+    double start = seconds();
+    for (int round = 0; round < 20; round++)
+        read_uint32_array_scalar(dst, src, POOL_WORDS);
+    double scalar = seconds() - start;
+
+    start = seconds();
+    for (int round = 0; round < 20; round++)
+        read_uint32_array(dst, src, POOL_WORDS);
+    double bulk = seconds() - start;
+
+    fprintf(stderr, "  20 x %u words: scalar %.2f ms, %s %.2f ms\n", POOL_WORDS,
+            scalar * 1e3, read_uint32_array_variant(), bulk * 1e3);
+
+    free(dst);
+    free(src);
+}
+#endif
+
+int main(void)
+{
+    fprintf(stderr, "*** testbswap: BULK BYTE SWAP ......\n");
+    RUN_TEST(test_matches_scalar);
+    RUN_TEST(test_in_place);
+    RUN_TEST(test_pool);
+#ifdef BSWAP_BENCH
+    bench_pool();
+#endif
+    return END_TEST();
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+#include "fileutil.h"
+
+/* testcache
+
+Loads the same binaries repeatedly through the program cache.
+
+*/
+
+void test_hits(void)
+{
+    program_cache_stats s;
+    set_program_cache_limit(16 << 20);
+
+    ijvm_program *a = load_program("files/task5/fib.ijvm");
+    ijvm_program *b = load_program("files/task5/../task5/fib.ijvm");
+    assert(a != NULL && a == b);
+
+    ijvm *m = init_ijvm_std("files/task5/fib.ijvm");
+    assert(m != NULL);
+    run(m);
+    assert(get_local_variable(m, 0) == 10946);
+    destroy_ijvm(m);
+
+    get_program_cache_stats(&s);
+    assert(s.misses == 1);
+    assert(s.hits == 2);
+    assert(s.entries == 1);
+    assert(s.bytes > 0);
+
+    release_program(a);
+    release_program(b);
+    set_program_cache_limit(0);
+    get_program_cache_stats(&s);
+    assert(s.entries == 0 && s.bytes == 0);
+}
+
+void test_rewritten_file(void)
+{
+    program_cache_stats before, after;
+    set_program_cache_limit(16 << 20);
+    const char *path = "testcache.ijvm";
+
+    copy_file("files/task5/fib.ijvm", path);
+    ijvm_program *a = load_program(path);
+    assert(a != NULL);
+
+    // a different binary under the same name
+    copy_file("files/task2/TestBipush1.ijvm", path);
+    get_program_cache_stats(&before);
+    ijvm_program *b = load_program(path);
+    get_program_cache_stats(&after);
+    assert(b != NULL && b != a);
+    assert(after.misses == before.misses + 1);
+
+    release_program(a);
+    release_program(b);
+    remove(path);
+    set_program_cache_limit(0);
+}
+
+void test_eviction(void)
+{
+    program_cache_stats s;
+    set_program_cache_limit(16 << 20);
+    ijvm_program *a = load_program("files/task5/fib.ijvm");
+    assert(a != NULL);
+    get_program_cache_stats(&s);
+    size_t one = s.bytes;
+
+    // room for fib alone, so loading another program pushes it out
+    set_program_cache_limit(one);
+    ijvm_program *b = load_program("files/task2/TestBipush1.ijvm");
+    assert(b != NULL);
+    get_program_cache_stats(&s);
+    assert(s.evictions >= 1);
+    assert(s.bytes <= one);
+
+    // the evicted program stays usable through its own reference
+    ijvm *m = init_ijvm_from_program(a, stdin, stdout);
+    run(m);
+    assert(get_local_variable(m, 0) == 10946);
+    destroy_ijvm(m);
+
+    release_program(a);
+    release_program(b);
+    set_program_cache_limit(0);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** testcache: PROGRAM CACHE ......\n");
+    RUN_TEST(test_hits);
+    RUN_TEST(test_rewritten_file);
+    RUN_TEST(test_eviction);
+    return END_TEST();
+}
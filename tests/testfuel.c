@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+
+/* testfuel
+
+Stops machines that run out of fuel, and lets them continue with more.
+
+*/
+
+// main: L: GOTO L
+static const uint8_t spin[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03,
+    0xA7, 0x00, 0x00,
+};
+
+void test_endless_loop(void)
+{
+    ijvm *m = init_ijvm_from_memory(spin, sizeof(spin), stdin, stdout);
+    assert(m != NULL);
+    assert(get_fuel(m) == IJVM_FUEL_UNLIMITED);
+
+    set_fuel(m, 1000);
+    run(m);
+    assert(finished(m));
+    assert(is_out_of_fuel(m));
+    assert(get_fuel(m) == 0);
+    assert(get_program_counter(m) == 0);
+
+    set_fuel(m, 10);
+    assert(!finished(m) && !is_out_of_fuel(m));
+    run(m);
+    assert(is_out_of_fuel(m) && get_fuel(m) == 0);
+
+    destroy_ijvm(m);
+}
+
+// Instructions fib.ijvm runs from start to end
+static uint64_t fib_length(void)
+{
+    ijvm *m = init_ijvm_std("files/task5/fib.ijvm");
+    assert(m != NULL);
+    uint64_t n = step_n(m, UINT64_MAX);
+    assert(finished(m));
+    destroy_ijvm(m);
+    return n;
+}
+
+void test_exact_budget(void)
+{
+    uint64_t n = fib_length();
+
+    ijvm *m = init_ijvm_std("files/task5/fib.ijvm");
+    assert(m != NULL);
+    set_fuel(m, n);
+    run(m);
+    assert(finished(m) && !is_out_of_fuel(m));
+    assert(get_fuel(m) == 0);
+    assert(get_local_variable(m, 0) == 10946);
+    destroy_ijvm(m);
+}
+
+void test_resume(void)
+{
+    uint64_t n = fib_length();
+
+    ijvm *m = init_ijvm_std("files/task5/fib.ijvm");
+    assert(m != NULL);
+
+    // what run() leaves over is spent one instruction at a time by step_n()
+    set_fuel(m, n / 2);
+    run(m);
+    assert(is_out_of_fuel(m));
+    uint64_t left = get_fuel(m);
+    assert(left < n / 2);
+    assert(step_n(m, UINT64_MAX) == 0);
+    set_fuel(m, left);
+    assert(step_n(m, UINT64_MAX) == left);
+    assert(is_out_of_fuel(m) && get_fuel(m) == 0);
+
+    step(m);
+    assert(is_out_of_fuel(m));
+
+    set_fuel(m, n - n / 2);
+    run(m);
+    assert(finished(m) && !is_out_of_fuel(m));
+    assert(get_fuel(m) == 0);
+    assert(get_local_variable(m, 0) == 10946);
+    destroy_ijvm(m);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** testfuel: FUEL ...\n");
+    RUN_TEST(test_endless_loop);
+    RUN_TEST(test_exact_budget);
+    RUN_TEST(test_resume);
+    return END_TEST();
+}
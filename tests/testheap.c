@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+
+/* testheap
+
+NEWARRAY, IALOAD and IASTORE, the machine stopping at accesses outside an
+array, and the garbage collector.
+
+*/
+
+// main: a = new int[5]; a[4] = 42; push a[4]; push a[3]; push a[5]
+static const uint8_t store_load[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1C,
+    0x10, 0x05,       //  0: BIPUSH 5
+    0xD1,             //  2: NEWARRAY
+    0x36, 0x00,       //  3: ISTORE 0
+    0x10, 0x2A,       //  5: BIPUSH 42
+    0x10, 0x04,       //  7: BIPUSH 4
+    0x15, 0x00,       //  9: ILOAD 0
+    0xD3,             // 11: IASTORE
+    0x10, 0x04,       // 12: BIPUSH 4
+    0x15, 0x00,       // 14: ILOAD 0
+    0xD2,             // 16: IALOAD
+    0x10, 0x03,       // 17: BIPUSH 3
+    0x15, 0x00,       // 19: ILOAD 0
+    0xD2,             // 21: IALOAD
+    0x10, 0x05,       // 22: BIPUSH 5
+    0x15, 0x00,       // 24: ILOAD 0
+    0xD2,             // 26: IALOAD
+    0xFF,             // 27: HALT
+};
+
+// main: for (i = 1; i < 3000; i++) { a = new int[i]; a[i - 1] = i;
+// if (a[i - 1] != i) ERR; } a = new int[100000]; a[99999] = 7; push a[99999]
+static const uint8_t many_arrays[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C,
+    0x00, 0x00, 0x0B, 0xB8, 0x00, 0x01, 0x86, 0xA0, 0x00, 0x01, 0x86, 0x9F,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x42,
+    0x10, 0x01,       //  0: BIPUSH 1
+    0x36, 0x00,       //  2: ISTORE 0
+    0x15, 0x00,       //  4: ILOAD 0
+    0xD1,             //  6: NEWARRAY
+    0x36, 0x01,       //  7: ISTORE 1
+    0x15, 0x00,       //  9: ILOAD 0
+    0x15, 0x00,       // 11: ILOAD 0
+    0x10, 0x01,       // 13: BIPUSH 1
+    0x64,             // 15: ISUB
+    0x15, 0x01,       // 16: ILOAD 1
+    0xD3,             // 18: IASTORE
+    0x15, 0x00,       // 19: ILOAD 0
+    0x10, 0x01,       // 21: BIPUSH 1
+    0x64,             // 23: ISUB
+    0x15, 0x01,       // 24: ILOAD 1
+    0xD2,             // 26: IALOAD
+    0x15, 0x00,       // 27: ILOAD 0
+    0x9F, 0x00, 0x04, // 29: IF_ICMPEQ 33
+    0xFE,             // 32: ERR
+    0x84, 0x00, 0x01, // 33: IINC 0 1
+    0x15, 0x00,       // 36: ILOAD 0
+    0x13, 0x00, 0x00, // 38: LDC_W 3000
+    0x64,             // 41: ISUB
+    0x9B, 0xFF, 0xDA, // 42: IFLT 4
+    0x13, 0x00, 0x01, // 45: LDC_W 100000
+    0xD1,             // 48: NEWARRAY
+    0x36, 0x01,       // 49: ISTORE 1
+    0x10, 0x07,       // 51: BIPUSH 7
+    0x13, 0x00, 0x02, // 53: LDC_W 99999
+    0x15, 0x01,       // 56: ILOAD 1
+    0xD3,             // 58: IASTORE
+    0x13, 0x00, 0x02, // 59: LDC_W 99999
+    0x15, 0x01,       // 62: ILOAD 1
+    0xD2,             // 64: IALOAD
+    0xFF,             // 65: HALT
+};
+
+// main: a = new int[3]; a[0] = -1; push (a + 1)[1000000]; pop; push 0[0]
+static const uint8_t forged[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x00, 0x0F, 0x42, 0x40,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1C,
+    0x10, 0x03,       //  0: BIPUSH 3
+    0xD1,             //  2: NEWARRAY
+    0x36, 0x00,       //  3: ISTORE 0
+    0x10, 0xFF,       //  5: BIPUSH -1
+    0x10, 0x00,       //  7: BIPUSH 0
+    0x15, 0x00,       //  9: ILOAD 0
+    0xD3,             // 11: IASTORE
+    0x13, 0x00, 0x00, // 12: LDC_W 1000000
+    0x15, 0x00,       // 15: ILOAD 0
+    0x10, 0x01,       // 17: BIPUSH 1
+    0x60,             // 19: IADD
+    0xD2,             // 20: IALOAD
+    0x57,             // 21: POP
+    0x10, 0x00,       // 22: BIPUSH 0
+    0x10, 0x00,       // 24: BIPUSH 0
+    0xD2,             // 26: IALOAD
+    0xFF,             // 27: HALT
+};
+
+// main: push new int[-1]
+static const uint8_t negative[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x10, 0xFF,       //  0: BIPUSH -1
+    0xD1,             //  2: NEWARRAY
+    0xFF,             //  3: HALT
+};
+
+// main: push new int[5]; pop; GC; push new int[5]
+static const uint8_t reuse[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09,
+    0x10, 0x05,       //  0: BIPUSH 5
+    0xD1,             //  2: NEWARRAY
+    0x57,             //  3: POP
+    0xD4,             //  4: GC
+    0x10, 0x05,       //  5: BIPUSH 5
+    0xD1,             //  7: NEWARRAY
+    0xFF,             //  8: HALT
+};
+
+// main: for (i = 20000; i != 0; i--) new int[1000]
+static const uint8_t garbage[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
+    0x00, 0x00, 0x4E, 0x20, 0x00, 0x00, 0x03, 0xE8,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x16,
+    0x13, 0x00, 0x00, //  0: LDC_W 20000
+    0x36, 0x00,       //  3: ISTORE 0
+    0x13, 0x00, 0x01, //  5: LDC_W 1000
+    0xD1,             //  8: NEWARRAY
+    0x57,             //  9: POP
+    0x84, 0x00, 0xFF, // 10: IINC 0 -1
+    0x15, 0x00,       // 13: ILOAD 0
+    0x99, 0x00, 0x06, // 15: IFEQ 21
+    0xA7, 0xFF, 0xF3, // 18: GOTO 5
+    0xFF,             // 21: HALT
+};
+
+// main: a = new int[3]; pop f(a); GC
+// f(a): b = a; pop new int[5]; GC; return 0
+static const uint8_t frames[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x00, 0x00, 0x00, 0x0B,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1B,
+    0x10, 0x00,       //  0: BIPUSH 0 (OBJREF)
+    0x10, 0x03,       //  2: BIPUSH 3
+    0xD1,             //  4: NEWARRAY
+    0xB6, 0x00, 0x00, //  5: INVOKEVIRTUAL f
+    0x57,             //  8: POP
+    0xD4,             //  9: GC
+    0xFF,             // 10: HALT
+    0x00, 0x02,       // 11: f, 2 args
+    0x00, 0x01,       //     1 local
+    0x15, 0x01,       // 15: ILOAD 1
+    0x36, 0x02,       // 17: ISTORE 2
+    0x10, 0x05,       // 19: BIPUSH 5
+    0xD1,             // 21: NEWARRAY
+    0x57,             // 22: POP
+    0xD4,             // 23: GC
+    0x10, 0x00,       // 24: BIPUSH 0
+    0xAC,             // 26: IRETURN
+};
+
+// Where store_load stops, at the IALOAD past the end, whatever runs it
+static void check_stopped(ijvm *m)
+{
+    assert(finished(m));
+    assert(get_program_counter(m) == 26);
+    assert(tos(m) == get_local_variable(m, 0));
+}
+
+void test_store_load(void)
+{
+    ijvm *m = init_ijvm_from_memory(store_load, sizeof(store_load), stdin, stdout);
+    assert(m != NULL);
+    ijvm_breakpoint at = {17, -1};
+    run_until(m, &at, UINT64_MAX);
+    assert(tos(m) == 42);
+    at.pc = 22;
+    run_until(m, &at, UINT64_MAX);
+    assert(tos(m) == 0);
+    run(m);
+    check_stopped(m);
+    destroy_ijvm(m);
+
+    m = init_ijvm_from_memory(store_load, sizeof(store_load), stdin, stdout);
+    assert(m != NULL);
+    while (!finished(m))
+        step(m);
+    check_stopped(m);
+    destroy_ijvm(m);
+
+    m = init_ijvm_from_memory(store_load, sizeof(store_load), stdin, stdout);
+    assert(m != NULL);
+    step_n(m, UINT64_MAX);
+    check_stopped(m);
+    destroy_ijvm(m);
+}
+
+void test_many_arrays(void)
+{
+    FILE *out = tmpfile();
+    ijvm *m = init_ijvm_from_memory(many_arrays, sizeof(many_arrays), stdin, out);
+    assert(m != NULL);
+    run(m);
+    assert(finished(m));
+    assert(get_program_counter(m) == sizeof(many_arrays) - 32);
+    assert(tos(m) == 7);
+
+    // no ERR on the way
+    fseek(out, 0, SEEK_END);
+    assert(ftell(out) == 0);
+
+    destroy_ijvm(m);
+    fclose(out);
+}
+
+void test_forged_reference(void)
+{
+    ijvm *m = init_ijvm_from_memory(forged, sizeof(forged), stdin, stdout);
+    assert(m != NULL);
+    run(m);
+    assert(finished(m));
+    assert(get_program_counter(m) == 26);
+    destroy_ijvm(m);
+}
+
+void test_negative_length(void)
+{
+    ijvm *m = init_ijvm_from_memory(negative, sizeof(negative), stdin, stdout);
+    assert(m != NULL);
+    run(m);
+    assert(finished(m));
+    assert(get_program_counter(m) == 2);
+    assert(tos(m) == -1);
+    destroy_ijvm(m);
+}
+
+void test_reuse_after_gc(void)
+{
+    ijvm *m = init_ijvm_from_memory(reuse, sizeof(reuse), stdin, stdout);
+    assert(m != NULL);
+    step(m);
+    step(m);
+    word_t ref = tos(m);
+    assert(!is_heap_freed(m, ref));
+    step(m);
+    step(m);
+    assert(is_heap_freed(m, ref));
+
+    gc_stats stats;
+    get_gc_stats(m, &stats);
+    assert(stats.collections == 1);
+    assert(stats.last_reclaimed_bytes == 6 * sizeof(word_t));
+    assert(stats.live_bytes == 0);
+
+    // the space of the dead array goes to the next one
+    run(m);
+    assert(finished(m));
+    assert(tos(m) == ref);
+    assert(!is_heap_freed(m, ref));
+    destroy_ijvm(m);
+}
+
+void test_frames_are_roots(void)
+{
+    ijvm *m = init_ijvm_from_memory(frames, sizeof(frames), stdin, stdout);
+    assert(m != NULL);
+    ijvm_breakpoint at = {22, -1};
+    run_until(m, &at, UINT64_MAX);
+    word_t dropped = tos(m);
+    word_t kept = get_local_variable(m, 1);
+    at.pc = 24;
+    run_until(m, &at, UINT64_MAX);
+
+    // held by the argument and the local of f, not by anything above them
+    assert(!is_heap_freed(m, kept));
+    assert(get_local_variable(m, 2) == kept);
+    assert(is_heap_freed(m, dropped));
+
+    // f's frame is gone, and with it the last reference
+    run(m);
+    assert(finished(m));
+    assert(is_heap_freed(m, kept));
+    destroy_ijvm(m);
+}
+
+void test_collected_under_pressure(void)
+{
+    ijvm *m = init_ijvm_from_memory(garbage, sizeof(garbage), stdin, stdout);
+    assert(m != NULL);
+    run(m);
+    assert(finished(m));
+    assert(get_program_counter(m) == 22);
+
+    // 80 MB allocated, nothing kept: the heap never grows much past the
+    // point where a collection is due
+    gc_stats stats;
+    get_gc_stats(m, &stats);
+    assert(stats.collections >= 10);
+    assert(stats.total_reclaimed_bytes >= 10 * ((size_t)4 << 20));
+    assert(stats.heap_bytes <= (size_t)16 << 20);
+    assert(stats.max_pause_ns >= stats.last_pause_ns);
+    assert(stats.total_pause_ns >= stats.max_pause_ns);
+    destroy_ijvm(m);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** testheap: ARRAYS ...\n");
+    RUN_TEST(test_store_load);
+    RUN_TEST(test_many_arrays);
+    RUN_TEST(test_forged_reference);
+    RUN_TEST(test_negative_length);
+    RUN_TEST(test_reuse_after_gc);
+    RUN_TEST(test_frames_are_roots);
+    RUN_TEST(test_collected_under_pressure);
+    return END_TEST();
+}
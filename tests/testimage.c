@@ -0,0 +1,133 @@
+// setenv is POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+#include "fileutil.h"
+
+/* testimage
+
+Loads programs through the on-disk image cache (IJVM_IMAGE_CACHE=1).
+
+*/
+
+#define BINARY "testimage.ijvm"
+#define CACHE "testimage.ijvm.cache"
+
+static bool exists(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f)
+        fclose(f);
+    return f != NULL;
+}
+
+static word_t run_fib(void)
+{
+    ijvm *m = init_ijvm_std(BINARY);
+    assert(m != NULL);
+    run(m);
+    word_t result = get_local_variable(m, 0);
+    destroy_ijvm(m);
+    return result;
+}
+
+void test_written_then_used(void)
+{
+    remove(CACHE);
+    copy_file("files/task5/fib.ijvm", BINARY);
+
+    assert(run_fib() == 10946);
+    assert(exists(CACHE));
+    assert(run_fib() == 10946);
+    assert(run_fib() == 10946);
+}
+
+void test_stale_cache(void)
+{
+    copy_file("files/task5/fib.ijvm", BINARY);
+    assert(run_fib() == 10946);
+
+    // the old cache file is still there, but belongs to another binary
+    copy_file("files/task3/GOTO1.ijvm", BINARY);
+    ijvm *m = init_ijvm_std(BINARY);
+    assert(m != NULL);
+    run(m);
+    assert(finished(m));
+    destroy_ijvm(m);
+
+    copy_file("files/task5/fib.ijvm", BINARY);
+    assert(run_fib() == 10946);
+}
+
+void test_corrupt_cache(void)
+{
+    copy_file("files/task5/fib.ijvm", BINARY);
+    FILE *f = fopen(CACHE, "wb");
+    assert(f != NULL);
+    fputs("not a cache file", f);
+    fclose(f);
+    assert(run_fib() == 10946);
+}
+
+// Writes garbage over the decoded stream in place, keeping size and header
+static void damage_cache(void)
+{
+    FILE *f = fopen(CACHE, "r+b");
+    assert(f != NULL);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    for (long at = size / 4; at < size / 2; at += 7)
+    {
+        fseek(f, at, SEEK_SET);
+        fputc(0xFF, f);
+    }
+    fclose(f);
+}
+
+void test_damaged_body(void)
+{
+    copy_file("files/task5/fib.ijvm", BINARY);
+    assert(run_fib() == 10946);
+
+    damage_cache();
+    assert(run_fib() == 10946);
+    // and it was written again
+    assert(run_fib() == 10946);
+}
+
+void test_damaged_while_cached(void)
+{
+    program_cache_stats before;
+    get_program_cache_stats(&before);
+
+    // a program mapping the cache file, kept in the program cache
+    copy_file("files/task5/fib.ijvm", BINARY);
+    set_program_cache_limit(0);
+    assert(run_fib() == 10946);
+    set_program_cache_limit((size_t)64 << 20);
+    assert(run_fib() == 10946);
+
+    damage_cache();
+    assert(run_fib() == 10946);
+    assert(run_fib() == 10946);
+
+    set_program_cache_limit(before.limit);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** testimage: IMAGE CACHE ......\n");
+    setenv("IJVM_IMAGE_CACHE", "1", 1);
+    RUN_TEST(test_written_then_used);
+    RUN_TEST(test_stale_cache);
+    RUN_TEST(test_corrupt_cache);
+    RUN_TEST(test_damaged_body);
+    RUN_TEST(test_damaged_while_cached);
+    remove(BINARY);
+    remove(CACHE);
+    return END_TEST();
+}
@@ -0,0 +1,293 @@
+// pipe, write, close and fdopen are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+
+/* testio
+
+Buffered OUT and IN, and machines doing I/O through memory and callbacks
+instead of FILEs.
+
+*/
+
+// Runs binary on input with an OUT buffer of size bytes (-1 for the
+// default) and returns what it printed, at most len - 1 bytes
+static void run_with_buffer(char *binary, const char *input, long size, char *buf, size_t len)
+{
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    fputs(input, in);
+    rewind(in);
+
+    ijvm *m = init_ijvm(binary, in, out);
+    assert(m != NULL);
+    if (size >= 0)
+        assert(set_output_buffer(m, (size_t)size));
+    run(m);
+
+    memset(buf, 0, len);
+    rewind(out);
+    fread(buf, 1, len - 1, out);
+    destroy_ijvm(m);
+    fclose(out);
+    fclose(in);
+}
+
+void test_buffer_sizes(void)
+{
+    const long sizes[] = {0, 1, 5};
+    char expected[1024];
+    char actual[1024];
+
+    run_with_buffer("files/advanced/SimpleCalc.ijvm", "7 5 - ? 9 3 + ? 4 4 + ? .", -1, expected, sizeof(expected));
+    assert(strncmp(expected, "2\n12\n8\n", 7) == 0);
+    for (int i = 0; i < 3; i++)
+    {
+        run_with_buffer("files/advanced/SimpleCalc.ijvm", "7 5 - ? 9 3 + ? 4 4 + ? .", sizes[i], actual, sizeof(actual));
+        assert(strcmp(expected, actual) == 0);
+    }
+
+    run_with_buffer("files/advanced/Tanenbaum.ijvm", "", -1, expected, sizeof(expected));
+    for (int i = 0; i < 3; i++)
+    {
+        run_with_buffer("files/advanced/Tanenbaum.ijvm", "", sizes[i], actual, sizeof(actual));
+        assert(strcmp(expected, actual) == 0);
+    }
+}
+
+void test_flushed_on_return(void)
+{
+    FILE *out = tmpfile();
+    ijvm *m = init_ijvm("files/task2/TestInOut.ijvm", stdin, out);
+    assert(m != NULL);
+
+    // TestInOut prints what it read in reverse; with nothing to read that
+    // is five NULs, each visible as soon as the OUT printing it returns
+    ijvm_breakpoint at = {-1, OP_OUT};
+    for (long printed = 1; printed <= 5; printed++)
+    {
+        run_until(m, &at, UINT64_MAX);
+        step(m);
+        fseek(out, 0, SEEK_END);
+        assert(ftell(out) == printed);
+    }
+
+    destroy_ijvm(m);
+    fclose(out);
+}
+
+void test_err_after_output(void)
+{
+    char buf[64];
+    run_with_buffer("files/task2/TestErr.ijvm", "", -1, buf, sizeof(buf));
+    assert(strcmp(buf, "ERROR\n") == 0);
+}
+
+void test_input_from_slow_pipe(void)
+{
+    int fds[2];
+    assert(pipe(fds) == 0);
+    FILE *in = fdopen(fds[0], "r");
+    FILE *out = tmpfile();
+    ijvm *m = init_ijvm("files/task2/TestInOut.ijvm", in, out);
+    assert(m != NULL);
+
+    // only part of the input has arrived; IN must not wait for a full block
+    assert(write(fds[1], "AB", 2) == 2);
+    ijvm_breakpoint at = {-1, OP_IN};
+    for (int i = 0; i < 2; i++)
+    {
+        run_until(m, &at, UINT64_MAX);
+        step(m);
+    }
+    assert(tos(m) == 'B');
+
+    assert(write(fds[1], "CDE", 3) == 3);
+    close(fds[1]);
+    run(m);
+
+    char buf[8] = {0};
+    rewind(out);
+    fread(buf, 1, 5, out);
+    assert(strcmp(buf, "EDCBA") == 0);
+
+    destroy_ijvm(m);
+    fclose(out);
+    fclose(in);
+}
+
+void test_input_handed_back(void)
+{
+    FILE *in = tmpfile();
+    FILE *out = get_null_output();
+    fputs("ABCDEFGH", in);
+    rewind(in);
+
+    ijvm *m = init_ijvm("files/task2/TestInOut.ijvm", in, out);
+    assert(m != NULL);
+    run(m);
+    assert(finished(m));
+    // TestInOut reads five bytes, the rest is still there
+    assert(fgetc(in) == 'F');
+
+    destroy_ijvm(m);
+    fclose(out);
+    fclose(in);
+}
+
+void test_pipe_shared_with_caller(void)
+{
+    int fds[2];
+    assert(pipe(fds) == 0);
+    FILE *in = fdopen(fds[0], "r");
+    assert(write(fds[1], "ABCDEFGHI", 9) == 9);
+    close(fds[1]);
+
+    // the caller has read from the pipe before, so the FILE holds the rest
+    assert(fgetc(in) == 'A');
+
+    char buf[8] = {0};
+    FILE *out = tmpfile();
+    ijvm *m = init_ijvm("files/task2/TestInOut.ijvm", in, out);
+    assert(m != NULL);
+    run(m);
+    assert(finished(m));
+    rewind(out);
+    fread(buf, 1, 5, out);
+    assert(strcmp(buf, "FEDCB") == 0);
+    destroy_ijvm(m);
+    fclose(out);
+
+    // what the machine read ahead went back into the pipe's FILE
+    assert(fgetc(in) == 'G');
+
+    // and a later machine starts where the caller left off
+    out = tmpfile();
+    m = init_ijvm("files/task2/TestInOut.ijvm", in, out);
+    assert(m != NULL);
+    run(m);
+    memset(buf, 0, sizeof(buf));
+    rewind(out);
+    fread(buf, 1, 5, out);
+    assert(memcmp(buf, "\0\0\0IH", 5) == 0);
+    destroy_ijvm(m);
+
+    fclose(out);
+    fclose(in);
+}
+
+void test_memory_channels(void)
+{
+    ijvm_program *p = load_program("files/task2/TestInOut.ijvm");
+    assert(p != NULL);
+
+    // a machine never needs a file descriptor, so thousands cost nothing
+    const uint8_t input[] = "ABCDE";
+    ijvm_io io = {.in_data = input, .in_size = 5};
+    for (int i = 0; i < 1000; i++)
+    {
+        ijvm *m = init_ijvm_with_io(p, &io);
+        assert(m != NULL);
+        run(m);
+        assert(finished(m));
+
+        size_t len;
+        const uint8_t *out = get_output(m, &len);
+        assert(len == 5 && memcmp(out, "EDCBA", 5) == 0);
+        clear_output(m);
+        assert(get_output(m, &len) != NULL && len == 0);
+        destroy_ijvm(m);
+    }
+
+    // input that runs out reads as 0, output that outgrows the buffer is kept
+    io.in_size = 2;
+    ijvm *m = init_ijvm_with_io(p, &io);
+    assert(m != NULL);
+    assert(set_output_buffer(m, 1));
+    run(m);
+    size_t len;
+    const uint8_t *out = get_output(m, &len);
+    assert(len == 5 && memcmp(out, "\0\0\0BA", 5) == 0);
+    destroy_ijvm(m);
+
+    // FILE machines have nothing to collect
+    m = init_ijvm_from_program(p, stdin, stdout);
+    assert(get_output(m, &len) == NULL && len == 0);
+    destroy_ijvm(m);
+
+    release_program(p);
+}
+
+// Hands out input a byte at a time and records what was printed
+typedef struct
+{
+    const char *input;
+    char output[64];
+    size_t printed;
+} channel;
+
+static size_t channel_read(void *ctx, uint8_t *buf, size_t len)
+{
+    channel *c = (channel *)ctx;
+    if (len == 0 || *c->input == '\0')
+        return 0;
+    buf[0] = (uint8_t)*c->input++;
+    return 1;
+}
+
+static void channel_write(void *ctx, const uint8_t *buf, size_t len)
+{
+    channel *c = (channel *)ctx;
+    assert(c->printed + len < sizeof(c->output));
+    memcpy(c->output + c->printed, buf, len);
+    c->printed += len;
+}
+
+void test_callback_channels(void)
+{
+    ijvm_program *p = load_program("files/advanced/SimpleCalc.ijvm");
+    assert(p != NULL);
+
+    // the caller's bytes come first, then the callback takes over
+    const uint8_t start[] = "7 5 - ? 9 ";
+    channel c = {.input = "3 + ? 4 4 + ? ."};
+    ijvm_io io = {.in_data = start, .in_size = sizeof(start) - 1,
+                  .in_read = channel_read, .out_write = channel_write, .ctx = &c};
+    const long sizes[] = {-1, 0, 1};
+    for (int i = 0; i < 3; i++)
+    {
+        c.input = "3 + ? 4 4 + ? .";
+        c.printed = 0;
+        ijvm *m = init_ijvm_with_io(p, &io);
+        assert(m != NULL);
+        if (sizes[i] >= 0)
+            assert(set_output_buffer(m, (size_t)sizes[i]));
+        run(m);
+        assert(c.printed == 7 && memcmp(c.output, "2\n12\n8\n", 7) == 0);
+
+        size_t len;
+        assert(get_output(m, &len) == NULL);
+        destroy_ijvm(m);
+    }
+
+    release_program(p);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** testio: BUFFERED I/O ...\n");
+    RUN_TEST(test_buffer_sizes);
+    RUN_TEST(test_flushed_on_return);
+    RUN_TEST(test_err_after_output);
+    RUN_TEST(test_input_from_slow_pipe);
+    RUN_TEST(test_input_handed_back);
+    RUN_TEST(test_pipe_shared_with_caller);
+    RUN_TEST(test_memory_channels);
+    RUN_TEST(test_callback_channels);
+    return END_TEST();
+}
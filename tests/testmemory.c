@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+
+/* testmemory
+
+Loads programs from memory buffers instead of files.
+
+*/
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *len = (size_t)ftell(fp);
+    rewind(fp);
+    uint8_t *buf = (uint8_t *)malloc(*len);
+    if (buf && fread(buf, 1, *len, fp) != *len)
+    {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    return buf;
+}
+
+void test_copied(void)
+{
+    size_t len;
+    uint8_t *buf = read_file("files/task5/fib.ijvm", &len);
+    assert(buf != NULL);
+
+    ijvm *m = init_ijvm_from_memory(buf, len, stdin, stdout);
+    assert(m != NULL);
+    memset(buf, 0, len);
+    free(buf);
+
+    run(m);
+    assert(get_local_variable(m, 0) == 10946);
+    destroy_ijvm(m);
+}
+
+void test_borrowed(void)
+{
+    size_t len;
+    uint8_t *buf = read_file("files/task5/fib.ijvm", &len);
+    assert(buf != NULL);
+
+    ijvm *m = init_ijvm_from_memory_borrowed(buf, len, stdin, stdout);
+    assert(m != NULL);
+    assert(get_text(m) >= buf && get_text(m) < buf + len);
+
+    run(m);
+    assert(get_local_variable(m, 0) == 10946);
+    destroy_ijvm(m);
+    free(buf);
+}
+
+void test_same_checks_as_files(void)
+{
+    size_t len;
+    uint8_t *buf = read_file("files/task5/fib.ijvm", &len);
+    assert(buf != NULL);
+
+    // cut into the constant pool
+    assert(init_ijvm_from_memory(buf, 14, stdin, stdout) == NULL);
+    assert(init_ijvm_from_memory(buf, 3, stdin, stdout) == NULL);
+
+    // a text section cut short loads what is there
+    ijvm *m = init_ijvm_from_memory(buf, len - 1, stdin, stdout);
+    assert(m != NULL);
+    assert(get_text_size(m) == 0x3e - 1);
+    destroy_ijvm(m);
+    buf[0] ^= 0xFF;
+    assert(init_ijvm_from_memory(buf, len, stdin, stdout) == NULL);
+    free(buf);
+
+    buf = read_file("files/bonus/hardening/text_size_overflow.ijvm", &len);
+    assert(buf != NULL);
+    assert(init_ijvm_from_memory_borrowed(buf, len, stdin, stdout) == NULL);
+    free(buf);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** testmemory: LOADING FROM MEMORY ......\n");
+    RUN_TEST(test_copied);
+    RUN_TEST(test_borrowed);
+    RUN_TEST(test_same_checks_as_files);
+    return END_TEST();
+}
@@ -0,0 +1,163 @@
+// glob is POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <glob.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+
+/* testprogram
+
+Runs several machines on one shared program.
+
+*/
+
+void test_interleaved(void)
+{
+    ijvm_program *p = load_program("files/task5/fib.ijvm");
+    assert(p != NULL);
+    assert(get_program_references(p) == 1);
+
+    ijvm *a = init_ijvm_from_program(p, stdin, stdout);
+    ijvm *b = init_ijvm_from_program(p, stdin, stdout);
+    assert(a != NULL && b != NULL);
+    assert(get_program_references(p) == 3);
+    assert(get_text(a) == get_text(b));
+
+    // b starts a few instructions behind, so the two never share a pc
+    for (int i = 0; i < 7; i++)
+        step(a);
+    while (!finished(a) || !finished(b))
+    {
+        if (!finished(a))
+            step(a);
+        if (!finished(b))
+            step(b);
+    }
+    assert(get_local_variable(a, 0) == 10946);
+    assert(get_local_variable(b, 0) == 10946);
+
+    destroy_ijvm(a);
+    assert(get_program_references(p) == 2);
+    destroy_ijvm(b);
+    assert(get_program_references(p) == 1);
+    release_program(p);
+}
+
+void test_outlives_caller_reference(void)
+{
+    ijvm_program *p = load_program("files/advanced/SimpleCalc.ijvm");
+    assert(p != NULL);
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    fprintf(in, "7 5 - ? .");
+    rewind(in);
+
+    ijvm *m = init_ijvm_from_program(p, in, out);
+    assert(m != NULL);
+    release_program(p);
+    run(m);
+    destroy_ijvm(m);
+
+    rewind(out);
+    char buf[64] = {0};
+    fread(buf, 1, sizeof(buf) - 1, out);
+    assert(strcmp(buf, "2\n") == 0);
+    fclose(in);
+    fclose(out);
+}
+
+void test_bad_binary(void)
+{
+    assert(load_program("files/bonus/hardening/no_magic_number.ijvm") == NULL);
+    assert(load_program("files/does_not_exist.ijvm") == NULL);
+}
+
+void test_verified(void)
+{
+    const char *verified[] = {"files/task5/fib.ijvm", "files/advanced/Tanenbaum.ijvm"};
+    // a stack built in a loop and unwound in another, a reachable
+    // undefined opcode, and a real underflow
+    const char *checked[] = {"files/advanced/mandelbread.ijvm", "files/advanced/test-wide1.ijvm",
+                             "files/bonus/hardening/underflow_stack.ijvm"};
+    for (int i = 0; i < 2; i++)
+    {
+        ijvm_program *p = load_program(verified[i]);
+        assert(p != NULL && is_program_verified(p));
+        release_program(p);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        ijvm_program *p = load_program(checked[i]);
+        assert(p != NULL && !is_program_verified(p));
+        release_program(p);
+    }
+}
+
+// Shipped programs the verifier rejects, and why
+static const char *unverified[] = {
+    // not a binary
+    "files/task1/badfile.ijvm",
+    // pops what a loop pushed until two values match
+    "files/task3/IFICMPEQ1.ijvm",
+    // stacks whose depth depends on the input or a loop count
+    "files/advanced/SimpleCalc.ijvm",
+    "files/advanced/tallstack.ijvm",
+    "files/advanced/mandelbread.ijvm",
+    // main runs off its end into the header of the next method
+    "files/advanced/test-wide1.ijvm",
+    "files/advanced/test-wide2.ijvm",
+    "files/advanced/test-wide3.ijvm",
+    // TAILCALL and the network instructions are not implemented
+    "files/bonus/tailfib.ijvm",
+    "files/bonus/test_tailcall.ijvm",
+    "files/bonus/test_deep_tailcall.ijvm",
+    "files/bonus/test_netbind.ijvm",
+    "files/bonus/test_netconnect.ijvm",
+};
+#define UNVERIFIED (sizeof(unverified) / sizeof(unverified[0]))
+
+void test_shipped_programs_verify(void)
+{
+    glob_t found;
+    assert(glob("files/task*/*.ijvm", 0, NULL, &found) == 0);
+    assert(glob("files/examples/*.ijvm", GLOB_APPEND, NULL, &found) == 0);
+    assert(glob("files/advanced/*.ijvm", GLOB_APPEND, NULL, &found) == 0);
+    assert(glob("files/bonus/*.ijvm", GLOB_APPEND, NULL, &found) == 0);
+    assert(found.gl_pathc > 40);
+
+    for (size_t i = 0; i < found.gl_pathc; i++)
+    {
+        const char *path = found.gl_pathv[i];
+        bool expected = true;
+        for (size_t j = 0; j < UNVERIFIED && expected; j++)
+            expected = strcmp(path, unverified[j]) != 0;
+
+        ijvm_program *p = load_program(path);
+        if (!p)
+        {
+            assert(!expected);
+            continue;
+        }
+        if (is_program_verified(p) != expected)
+            fprintf(stderr, "  %s: verified %d\n", path, is_program_verified(p));
+        assert(is_program_verified(p) == expected);
+        release_program(p);
+    }
+    globfree(&found);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** testprogram: SHARED PROGRAMS ......\n");
+    // reference counts below assume nobody else holds on to the programs
+    set_program_cache_limit(0);
+    RUN_TEST(test_interleaved);
+    RUN_TEST(test_outlives_caller_reference);
+    RUN_TEST(test_bad_binary);
+    RUN_TEST(test_verified);
+    RUN_TEST(test_shipped_programs_verify);
+    return END_TEST();
+}
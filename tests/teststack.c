@@ -0,0 +1,181 @@
+// mmap, sigaction and sigsetjmp are POSIX, not C11
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+
+/* teststack
+
+The operand stack backends picked with set_stack_backend().
+
+*/
+
+// main: push 1 forever
+static const uint8_t endless[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05,
+    0x10, 0x01,       //  0: BIPUSH 1
+    0xA7, 0xFF, 0xFE, //  2: GOTO 0
+};
+
+// main: store to its last local with an empty operand stack, push over it
+static const uint8_t last_local[] = {
+    0x1D, 0xEA, 0xDF, 0xAD,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+    0x10, 0x41,       //  0: BIPUSH 0x41
+    0x36, 0xFF,       //  2: ISTORE 255
+    0x10, 0x01,       //  4: BIPUSH 1
+    0x57,             //  6: POP
+    0x84, 0xFF, 0x01, //  7: IINC 255 1
+    0x10, 0x01,       // 10: BIPUSH 1
+    0x57,             // 12: POP
+    0x15, 0xFF,       // 13: ILOAD 255
+    0xFF,             // 15: HALT
+};
+
+// Where tallstack or deep_recursion gets to before its IAND
+static word_t sum_before_iand(char *binary, bool stepped)
+{
+    ijvm *m = init_ijvm_std(binary);
+    assert(m != NULL);
+    if (stepped)
+    {
+        while (get_instruction(m) != OP_IAND)
+            step(m);
+    }
+    else
+    {
+        ijvm_breakpoint at = {-1, OP_IAND};
+        run_until(m, &at, UINT64_MAX);
+    }
+    word_t sum = tos(m);
+    destroy_ijvm(m);
+    return sum;
+}
+
+static sigjmp_buf fault_env;
+static volatile sig_atomic_t expecting = 0;
+static volatile sig_atomic_t faults = 0;
+
+// Takes the one fault the test makes itself; any other is fatal
+static void on_fault(int sig, siginfo_t *info, void *context)
+{
+    (void)info;
+    (void)context;
+    if (!expecting)
+    {
+        signal(sig, SIG_DFL);
+        return;
+    }
+    expecting = 0;
+    faults++;
+    siglongjmp(fault_env, 1);
+}
+
+// Has to run before anything makes a virtual stack, so that the handler
+// the stacks install finds this one to pass faults on to
+void test_foreign_fault_passed_on(void)
+{
+    struct sigaction sa;
+    sa.sa_sigaction = on_fault;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO;
+    assert(sigaction(SIGSEGV, &sa, NULL) == 0);
+
+    set_stack_backend(IJVM_STACK_VIRTUAL);
+    ijvm *m = init_ijvm_from_memory(endless, sizeof(endless), stdin, stdout);
+    set_stack_backend(IJVM_STACK_DEFAULT);
+    assert(m != NULL);
+
+    // a fault that is no stack overflow reaches the handler from before
+    volatile uint8_t *page = (volatile uint8_t *)mmap(NULL, 4096, PROT_NONE,
+                                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(page != MAP_FAILED);
+    expecting = 1;
+    if (sigsetjmp(fault_env, 1) == 0)
+        page[0] = 1;
+    assert(faults == 1);
+    munmap((void *)page, 4096);
+
+    // and a stack made before it still catches its overflow
+    run(m);
+    assert(finished(m));
+    assert(faults == 1);
+    destroy_ijvm(m);
+}
+
+void test_backends_agree(void)
+{
+    char *binaries[] = {"files/advanced/tallstack.ijvm", "files/advanced/deep_recursion.ijvm"};
+    for (int i = 0; i < 2; i++)
+    {
+        set_stack_backend(IJVM_STACK_GROWN);
+        word_t grown = sum_before_iand(binaries[i], false);
+        assert(grown == sum_before_iand(binaries[i], true));
+
+        set_stack_backend(IJVM_STACK_VIRTUAL);
+        assert(get_stack_backend() == IJVM_STACK_VIRTUAL);
+        assert(sum_before_iand(binaries[i], false) == grown);
+        assert(sum_before_iand(binaries[i], true) == grown);
+    }
+    set_stack_backend(IJVM_STACK_DEFAULT);
+}
+
+void test_last_local_survives_push(void)
+{
+    ijvm_stack_backend backends[] = {IJVM_STACK_GROWN, IJVM_STACK_VIRTUAL};
+    for (int i = 0; i < 2; i++)
+    {
+        set_stack_backend(backends[i]);
+        for (int stepped = 0; stepped < 2; stepped++)
+        {
+            ijvm *m = init_ijvm_from_memory(last_local, sizeof(last_local), stdin, stdout);
+            assert(m != NULL);
+            if (stepped)
+            {
+                while (!finished(m))
+                    step(m);
+            }
+            else
+                run(m);
+            assert(get_local_variable(m, 255) == 0x42);
+            assert(tos(m) == 0x42);
+            destroy_ijvm(m);
+        }
+    }
+    set_stack_backend(IJVM_STACK_DEFAULT);
+}
+
+void test_virtual_overflow(void)
+{
+    set_stack_backend(IJVM_STACK_VIRTUAL);
+    ijvm *m = init_ijvm_from_memory(endless, sizeof(endless), stdin, stdout);
+    set_stack_backend(IJVM_STACK_DEFAULT);
+    assert(m != NULL);
+
+    // only what has been touched is backed by memory
+    assert(get_stack_committed_bytes(m) < ((size_t)1 << 20));
+
+    // the guard region ends the machine, not the process
+    run(m);
+    assert(finished(m));
+    assert(get_stack_committed_bytes(m) >= ((size_t)255 << 20));
+    destroy_ijvm(m);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** teststack: STACK BACKENDS ...\n");
+    RUN_TEST(test_foreign_fault_passed_on);
+    RUN_TEST(test_backends_agree);
+    RUN_TEST(test_last_local_survives_push);
+    RUN_TEST(test_virtual_overflow);
+    return END_TEST();
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/ijvm.h"
+#include "../include/ijvm_ext.h"
+#include "testutil.h"
+#define SUM  2147385345
+
+/* teststep
+
+Batch stepping with step_n() and run_until(), checked against step().
+
+*/
+
+// Whether the two machines stand at the same point of the same program
+static bool same_state(ijvm *a, ijvm *b)
+{
+    return get_program_counter(a) == get_program_counter(b) &&
+           finished(a) == finished(b) &&
+           get_call_stack_size(a) == get_call_stack_size(b) &&
+           tos(a) == tos(b);
+}
+
+static void compare_with_step(char *binary)
+{
+    FILE *out = get_null_output();
+    ijvm *a = init_ijvm(binary, stdin, out);
+    ijvm *b = init_ijvm(binary, stdin, out);
+    assert(a != NULL && b != NULL);
+
+    for (uint64_t n = 1; !finished(b); n = n * 3 + 1)
+    {
+        uint64_t ran = 0;
+        for (uint64_t i = 0; i < n && !finished(a); i++, ran++)
+            step(a);
+        assert(step_n(b, n) == ran);
+        assert(same_state(a, b));
+    }
+    assert(step_n(b, 10) == 0);
+
+    destroy_ijvm(a);
+    destroy_ijvm(b);
+    fclose(out);
+}
+
+void test_step_n(void)
+{
+    compare_with_step("files/task5/fib.ijvm");
+    compare_with_step("files/advanced/Tanenbaum.ijvm");
+    // not verified, so on the checked loop
+    compare_with_step("files/advanced/mandelbread.ijvm");
+}
+
+void test_run_until_opcode(void)
+{
+    ijvm *a = init_ijvm_std("files/advanced/tallstack.ijvm");
+    ijvm *b = init_ijvm_std("files/advanced/tallstack.ijvm");
+    assert(a != NULL && b != NULL);
+
+    uint64_t steps = 0;
+    while (get_instruction(a) != OP_IAND)
+    {
+        step(a);
+        steps++;
+    }
+
+    ijvm_breakpoint at = {-1, OP_IAND};
+    assert(run_until(b, &at, UINT64_MAX) == steps);
+    assert(get_instruction(b) == OP_IAND);
+    assert(tos(b) == SUM);
+    assert(same_state(a, b));
+
+    // already there, so nothing runs
+    assert(run_until(b, &at, UINT64_MAX) == 0);
+
+    destroy_ijvm(a);
+    destroy_ijvm(b);
+}
+
+void test_run_until_pc(void)
+{
+    ijvm *m = init_ijvm_std("files/task5/fib.ijvm");
+    assert(m != NULL);
+
+    // the first call is main's, the second one is inside fib
+    ijvm_breakpoint at = {-1, OP_INVOKEVIRTUAL};
+    assert(run_until(m, &at, UINT64_MAX) > 0);
+    step(m);
+    assert(run_until(m, &at, UINT64_MAX) > 0);
+    assert(get_call_stack_size(m) == 1);
+    word_t call = (word_t)get_program_counter(m);
+
+    // and every later one goes through the same instruction
+    at.pc = call;
+    at.opcode = -1;
+    step(m);
+    assert(run_until(m, &at, UINT64_MAX) > 0);
+    assert(get_program_counter(m) == (unsigned int)call);
+    assert(get_call_stack_size(m) >= 2);
+
+    // the budget wins when it runs out first
+    step(m);
+    assert(run_until(m, &at, 1) == 1);
+    assert(!finished(m));
+
+    destroy_ijvm(m);
+}
+
+int main(void)
+{
+    fprintf(stderr, "*** teststep: BATCH STEPPING ...\n");
+    RUN_TEST(test_step_n);
+    RUN_TEST(test_run_until_opcode);
+    RUN_TEST(test_run_until_pc);
+    return END_TEST();
+}